@@ -7,8 +7,47 @@ LIBS += -lz -llzma -lbz2 -L../include/htslib/libhts.a -lhts
 INCLUDEPATH += include/
 
 SOURCES += \
-    src/main.cpp
+    src/bgzf_output.cpp \
+    src/checkpoint.cpp \
+    src/count_kernel.cpp \
+    src/depth_matrix.cpp \
+    src/fd_output.cpp \
+    src/input.cpp \
+    src/main.cpp \
+    src/output.cpp \
+    src/overlaps.cpp \
+    src/parameters.cpp \
+    src/pileup.cpp \
+    src/pipeline.cpp \
+    src/prefetch.cpp \
+    src/regions.cpp \
+    src/scheduler.cpp \
+    src/sequential.cpp \
+    src/stream.cpp \
+    src/task_pool.cpp \
+    src/units.cpp
 
 DISTFILES += \
 
 HEADERS += \
+    src/bgzf_output.h \
+    src/bounded_queue.h \
+    src/checkpoint.h \
+    src/count_kernel.h \
+    src/depth_matrix.h \
+    src/fd_output.h \
+    src/filter.h \
+    src/input.h \
+    src/nucleotides.h \
+    src/output.h \
+    src/overlaps.h \
+    src/parameters.h \
+    src/pileup.h \
+    src/pipeline.h \
+    src/prefetch.h \
+    src/regions.h \
+    src/scheduler.h \
+    src/sequential.h \
+    src/stream.h \
+    src/task_pool.h \
+    src/units.h
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include "bgzf_output.h"
+
+
+BgzfOutput::~BgzfOutput() {
+
+    if (this->file != nullptr) this->close();
+}
+
+
+int BgzfOutput::open(const char *path, htsThreadPool *thread_pool, bool index_rows) {
+
+    if ((this->file = bgzf_open(path, "w")) == nullptr) {
+        std::cerr << "Error opening output file <" << path << ">" << std::endl;
+        return 1;
+    }
+
+    this->path = path;
+    bool to_file = (this->path != "-");
+
+    // The block index must be enabled before compression threads start (the writer thread records blocks as they are written)
+    if (to_file && bgzf_index_build_init(this->file) != 0) {
+        std::cerr << "Error creating index for output file <" << path << ">" << std::endl;
+        return 1;
+    }
+
+    // Compression runs on the process-wide thread pool shared with input decompression
+    if (thread_pool != nullptr && thread_pool->pool != nullptr && bgzf_thread_pool(this->file, thread_pool->pool, 0) != 0) {
+        std::cerr << "Error attaching thread pool to output file <" << path << ">" << std::endl;
+        return 1;
+    }
+
+    this->indexing = to_file && index_rows;
+    this->buffer.resize(BGZF_OUTPUT_BUFFER_SIZE);
+    this->setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+
+    return 0;
+}
+
+
+int BgzfOutput::close() {
+
+    if (this->file == nullptr) return 1;
+
+    int return_value = (this->write_buffer() != 0 || this->failed) ? 1 : 0;
+
+    if (this->path != "-") {
+        if (bgzf_index_dump(this->file, this->path.c_str(), ".gzi") != 0) {
+            std::cerr << "Error writing index for output file <" << this->path << ">" << std::endl;
+            return_value = 1;
+        }
+        if (this->indexing && this->write_position_index() != 0) return_value = 1;
+    }
+
+    if (bgzf_close(this->file) != 0) {
+        std::cerr << "Error closing output file <" << this->path << ">" << std::endl;
+        return_value = 1;
+    }
+    this->file = nullptr;
+
+    return return_value;
+}
+
+
+int BgzfOutput::overflow(int c) {
+
+    if (this->write_buffer() != 0) return traits_type::eof();
+
+    if (c != traits_type::eof()) {
+        *this->pptr() = static_cast<char>(c);
+        this->pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+
+int BgzfOutput::sync() {
+
+    return (this->write_buffer() != 0) ? -1 : 0;
+}
+
+
+int BgzfOutput::write_buffer() {
+
+    size_t size = static_cast<size_t>(this->pptr() - this->pbase());
+    if (size == 0 || this->failed) return this->failed ? 1 : 0;
+
+    if (this->indexing) this->index_rows(this->pbase(), size);
+
+    if (bgzf_write(this->file, this->pbase(), size) < 0) {
+        std::cerr << "Error writing to output file <" << this->path << ">" << std::endl;
+        this->failed = true;
+        return 1;
+    }
+
+    this->offset += size;
+    this->setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+
+    return 0;
+}
+
+
+// Set <contig> and <start> (0-based) from a region line: "region=<contig>\tlen=<length>" for a whole contig, or
+// "region=<contig>:<start>-<end>\tlen=<length>" for a target region (1-based, inclusive: <length> = <end> - <start> + 1)
+static void parse_region(const std::string& line, std::string& contig, uint32_t& start) {
+
+    size_t tab = line.find('\t');
+    contig = line.substr(7, tab - 7);
+    start = 0;
+
+    size_t colon = contig.rfind(':'), dash = contig.rfind('-');
+    if (colon == std::string::npos || dash == std::string::npos || dash < colon) return;
+    char *start_end = nullptr, *end_end = nullptr, *length_end = nullptr;
+    unsigned long region_start = strtoul(contig.c_str() + colon + 1, &start_end, 10);
+    unsigned long region_end = strtoul(contig.c_str() + dash + 1, &end_end, 10);
+    unsigned long length = (tab == std::string::npos) ? 0 : strtoul(line.c_str() + tab + 5, &length_end, 10);
+    if (start_end != contig.c_str() + dash || *end_end != '\0' || region_start == 0 || region_end - region_start + 1 != length) return;
+
+    start = static_cast<uint32_t>(region_start - 1);
+    contig.resize(colon);
+}
+
+
+void BgzfOutput::index_rows(const char *data, size_t size) {
+
+    // Depth lines start with a digit; other lines are the "#Files" line and "region=<region>\tlen=<length>" lines starting a contig or a
+    // target region. The first line of each region is indexed, then every POSITION_INDEX_INTERVAL-th position of the contig
+    const char *start = data, *end = data + size;
+    while (data < end) {
+        if (this->line_start) {
+            this->line_start = false;
+            this->row = (*data >= '0' && *data <= '9');
+            if (this->row && (this->position % POSITION_INDEX_INTERVAL == 0 || this->region_start)) {
+                uint64_t line_offset = this->offset + static_cast<uint64_t>(data - start);
+                this->position_index += this->contig + "\t" + std::to_string(this->position) + "\t" + std::to_string(line_offset) + "\n";
+            }
+            if (this->row) this->region_start = false;
+            this->line.clear();
+        }
+        const char *newline = static_cast<const char*>(memchr(data, '\n', static_cast<size_t>(end - data)));
+        const char *line_end = (newline != nullptr) ? newline : end;
+        if (!this->row) this->line.append(data, static_cast<size_t>(line_end - data));
+        if (newline == nullptr) break;
+        if (this->row) {
+            ++this->position;
+        } else if (this->line.compare(0, 7, "region=") == 0) {
+            parse_region(this->line, this->contig, this->position);
+            this->region_start = true;
+        }
+        this->line_start = true;
+        data = newline + 1;
+    }
+}
+
+
+int BgzfOutput::write_position_index() {
+
+    std::string index_path = this->path + POSITION_INDEX_SUFFIX;
+    std::ofstream index_file(index_path);
+    index_file << POSITION_INDEX_MAGIC << "\t" << POSITION_INDEX_INTERVAL << "\n" << this->position_index;
+    index_file.close();
+
+    if (!index_file) {
+        std::cerr << "Error writing position index <" << index_path << ">" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
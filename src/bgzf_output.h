@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "htslib/htslib/bgzf.h"
+#include "htslib/htslib/hts.h"
+#include "htslib/htslib/thread_pool.h"
+
+// Size of the buffer collecting output before it is passed to BGZF
+#define BGZF_OUTPUT_BUFFER_SIZE 65536
+
+// Interval between positions recorded in the position index of text output
+#define POSITION_INDEX_INTERVAL 16384
+
+// Suffix of the position index file written next to BGZF text output
+#define POSITION_INDEX_SUFFIX ".pidx"
+
+// First line of a position index file, with the version of its format
+#define POSITION_INDEX_MAGIC "#pileup_pidx\t1"
+
+
+// Output stream buffer writing BGZF-compressed data, so that any std::ostream can write compressed output.
+// Compression runs on a htslib thread pool when one is given. When writing to a file, two indexes are written on close():
+// - <path>.gzi: htslib index of BGZF blocks, mapping uncompressed offsets to compressed offsets (see bgzf_index_load, bgzf_useek)
+// - for text output, <path>.pidx: position index giving the uncompressed offset of the first line of each region and of every
+//   POSITION_INDEX_INTERVAL-th position of each contig (format described in output.h). Binary output does not need it since its index already holds uncompressed offsets
+class BgzfOutput : public std::streambuf {
+
+    public:
+
+        BgzfOutput() {}
+        ~BgzfOutput();
+
+        BgzfOutput(const BgzfOutput&) = delete;
+        BgzfOutput& operator=(const BgzfOutput&) = delete;
+
+        // Open BGZF output to <path> ("-" for stdout). With <index_rows>, lines are scanned to build the position index (text output only).
+        // Returns 1 if the file could not be opened
+        int open(const char *path, htsThreadPool *thread_pool, bool index_rows);
+
+        // Write remaining data, the indexes, and close the file. Returns 1 on error
+        int close();
+
+    protected:
+
+        int overflow(int c) override;
+        int sync() override;
+
+    private:
+
+        int write_buffer();  // Pass the buffer content to BGZF, updating the position index. Returns 1 on error
+        void index_rows(const char *data, size_t size);  // Record positions of the lines in <data> in the position index
+        int write_position_index();  // Write the position index file. Returns 1 on error
+
+        BGZF *file = nullptr;
+        std::string path;
+        std::vector<char> buffer;
+        bool failed = false;
+
+        // Position index state, for text output
+        bool indexing = false;
+        uint64_t offset = 0;  // Uncompressed offset of the beginning of the buffer
+        bool line_start = true;  // The next character starts a line
+        bool row = false;  // The current line is a depth line (not a region or comment line)
+        std::string line;  // Content of the current region or comment line
+        std::string contig;  // Current contig
+        uint32_t position = 0;  // Position of the current (or next) depth line in the current contig
+        bool region_start = false;  // The next depth line is the first one of a region
+        std::string position_index;  // Content of the position index file
+};
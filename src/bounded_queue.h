@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+
+// Occupancy statistics for a bounded queue, used to find the slowest stage of a pipeline:
+// a queue that is often full has a slow consumer, a queue that is often empty has a slow producer
+struct QueueStats {
+    size_t capacity = 0;
+    uint64_t n_pop = 0;  // Number of items taken from the queue
+    uint64_t total_occupancy = 0;  // Sum of the number of items in the queue at each pop, to compute the mean occupancy
+    uint64_t full_waits = 0;  // Number of times a producer had to wait because the queue was full
+    uint64_t empty_waits = 0;  // Number of times a consumer had to wait because the queue was empty
+};
+
+
+// Thread-safe FIFO queue holding at most <capacity> items. push() blocks while the queue is full (backpressure on the producer)
+// and pop() blocks while the queue is empty. After close(), push() fails and pop() fails once the queue is empty
+template <typename T>
+class BoundedQueue {
+
+    public:
+
+        BoundedQueue(size_t capacity) { this->stats.capacity = capacity; }
+
+        // Add an item at the end of the queue, waiting for space if needed. Returns false if the queue was closed
+        bool push(T item) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->items.size() >= this->stats.capacity && !this->closed) ++this->stats.full_waits;
+            this->not_full.wait(lock, [this]{ return this->items.size() < this->stats.capacity || this->closed; });
+            if (this->closed) return false;
+            this->items.push_back(std::move(item));
+            this->not_empty.notify_one();
+            return true;
+        }
+
+        // Take the first item of the queue, waiting for an item if needed. Returns false if the queue is closed and empty
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            if (this->items.empty() && !this->closed) ++this->stats.empty_waits;
+            this->not_empty.wait(lock, [this]{ return !this->items.empty() || this->closed; });
+            if (this->items.empty()) return false;
+            this->stats.total_occupancy += this->items.size();
+            ++this->stats.n_pop;
+            item = std::move(this->items.front());
+            this->items.pop_front();
+            this->not_full.notify_one();
+            return true;
+        }
+
+        // Wake up all waiting threads; no item can be added after this call
+        void close() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->closed = true;
+            this->not_full.notify_all();
+            this->not_empty.notify_all();
+        }
+
+        QueueStats get_stats() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->stats;
+        }
+
+    private:
+
+        std::deque<T> items;
+        std::mutex mutex;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+        bool closed = false;
+        QueueStats stats;
+};
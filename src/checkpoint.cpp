@@ -0,0 +1,141 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "checkpoint.h"
+
+
+// Append the fingerprint line of file <path> to <manifest>: "file\t<path>\t<size>\t<modification time>" ("-" for a missing file)
+static void add_fingerprint(const std::string& path, std::string& manifest) {
+
+    struct stat stats;
+    manifest += "file\t" + path;
+    if (stat(path.c_str(), &stats) == 0) {
+        manifest += "\t" + std::to_string(stats.st_size) + "\t" + std::to_string(stats.st_mtim.tv_sec) + "." + std::to_string(stats.st_mtim.tv_nsec) + "\n";
+    } else {
+        manifest += "\t-\t-\n";
+    }
+}
+
+
+int Checkpoint::open(const Parameters& parameters) {
+
+    this->path = parameters.output + CHECKPOINT_SUFFIX;
+    this->last_checkpoint = std::chrono::steady_clock::now();
+
+    // Manifest: inputs and all options changing the output (workers, threads and readahead only change how the same output is computed)
+    for (auto file: parameters.alignment_files) add_fingerprint(file, this->manifest);
+    add_fingerprint(parameters.reference, this->manifest);
+    if (!parameters.regions.empty()) add_fingerprint(parameters.regions, this->manifest);
+    std::ostringstream options;
+    options << "options\tstream=" << parameters.stream << "\tchunk_size=" << parameters.chunk_size << "\tbatch_size=" << parameters.batch_size
+            << "\trequire_flags=" << parameters.filter.required_flags << "\texclude_flags=" << parameters.filter.excluded_flags
+            << "\tmin_mapq=" << static_cast<uint>(parameters.filter.min_mapq) << "\tmin_length=" << parameters.filter.min_length
+            << "\tmin_bq=" << static_cast<uint>(parameters.filter.min_base_quality) << "\tdedup_overlaps=" << parameters.filter.dedup_overlaps
+            << "\tformat=" << parameters.output_options.format << "\tmin_allele=" << parameters.output_options.min_allele_count
+            << "\tmin_depth=" << parameters.output_options.min_depth << "\n";
+    this->manifest += options.str();
+
+    // A new run removes the checkpoint of a previous run, which does not describe the new output
+    if (!parameters.resume) {
+        if (unlink(this->path.c_str()) != 0 && errno != ENOENT) {
+            std::cerr << "Error removing checkpoint <" << this->path << ">: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (access(this->path.c_str(), F_OK) != 0) {
+        std::cerr << "No checkpoint <" << this->path << ">, starting from the beginning" << std::endl;
+        return 0;
+    }
+
+    std::ifstream file(this->path);
+    std::string line, manifest;
+    bool valid = std::getline(file, line) && line == CHECKPOINT_MAGIC;
+    while (valid && std::getline(file, line) && line.compare(0, 6, "units\t") != 0) manifest += line + "\n";
+    valid = valid && sscanf(line.c_str(), "units\t%u", &this->n_units) == 1;
+    unsigned long long offset = 0;
+    valid = valid && std::getline(file, line) && sscanf(line.c_str(), "done\t%u\t%llu", &this->resumed_units, &offset) == 2;
+    int counts_start = 0;
+    valid = valid && std::getline(file, line) && sscanf(line.c_str(), "run\t%u\t%n", &this->resumed_state.run_length, &counts_start) == 1 && counts_start > 0;
+    if (!valid || this->resumed_units > this->n_units) {
+        std::cerr << "Error: invalid checkpoint <" << this->path << ">" << std::endl;
+        return 1;
+    }
+
+    if (manifest != this->manifest) {
+        std::cerr << "Error: checkpoint <" << this->path << "> was written for different input files or options. Expected:\n" << this->manifest
+                  << "Found:\n" << manifest << std::flush;
+        return 1;
+    }
+
+    this->resumed = true;
+    this->resumed_offset = static_cast<uint64_t>(offset);
+    if (this->resumed_state.run_length > 0) this->resumed_state.run_counts = line.substr(static_cast<size_t>(counts_start)) + "\n";
+
+    return 0;
+}
+
+
+int Checkpoint::set_units(uint n_units) {
+
+    if (this->resumed && n_units != this->n_units) {
+        std::cerr << "Error: checkpoint <" << this->path << "> was written for " << this->n_units << " units, this run has " << n_units << std::endl;
+        return 1;
+    }
+    this->n_units = n_units;
+
+    return 0;
+}
+
+
+int Checkpoint::record(uint n_written, std::ostream& out, FdOutput& output, const OutputState& state) {
+
+    uint n_done = this->resumed_units + n_written;
+    auto now = std::chrono::steady_clock::now();
+    if (n_done < this->n_units && now - this->last_checkpoint < std::chrono::seconds(CHECKPOINT_INTERVAL)) return 0;
+
+    // The output of the recorded units must be on disk before the checkpoint
+    uint64_t offset = 0;
+    out.flush();
+    if (!out || output.commit(offset) != 0) return 1;
+    if (this->write(n_done, offset, state) != 0) return 1;
+    this->last_checkpoint = now;
+
+    return 0;
+}
+
+
+int Checkpoint::write(uint n_done, uint64_t offset, const OutputState& state) {
+
+    std::string content = std::string(CHECKPOINT_MAGIC) + "\n" + this->manifest + "units\t" + std::to_string(this->n_units) + "\n"
+                          + "done\t" + std::to_string(n_done) + "\t" + std::to_string(offset) + "\n"
+                          + "run\t" + std::to_string(state.run_length) + "\t" + ((state.run_length > 0) ? state.run_counts : "\n");
+
+    // Written to a temporary file synced to disk, then renamed over the previous checkpoint: the checkpoint is either the previous or the new one
+    std::string tmp_path = this->path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = (fd >= 0 && ::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) && fsync(fd) == 0);
+    if (fd >= 0 && ::close(fd) != 0) written = false;
+    if (!written || rename(tmp_path.c_str(), this->path.c_str()) != 0) {
+        std::cerr << "Error writing checkpoint <" << this->path << ">: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // Sync the directory so that the rename itself is durable
+    size_t separator = this->path.rfind('/');
+    std::string directory = (separator == std::string::npos) ? "." : (separator == 0) ? "/" : this->path.substr(0, separator);
+    int directory_fd = ::open(directory.c_str(), O_RDONLY);
+    if (directory_fd >= 0) {
+        fsync(directory_fd);
+        ::close(directory_fd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include "fd_output.h"
+#include "output.h"
+#include "parameters.h"
+
+// Suffix of the checkpoint file written next to the output file
+#define CHECKPOINT_SUFFIX ".ckpt"
+
+// First line of a checkpoint file, with the version of its format
+#define CHECKPOINT_MAGIC "#pileup_checkpoint\t2"
+
+// Minimum time in seconds between two checkpoints (the last unit is always recorded), so that runs with many small units are not slowed
+// down by syncing the output after each of them
+#define CHECKPOINT_INTERVAL 30
+
+
+// Completion checkpoints of a run writing to an output file, allowing an interrupted run to be resumed. The checkpoint file <output>.ckpt holds:
+// - CHECKPOINT_MAGIC
+// - the manifest of the run: one line "file\t<path>\t<size>\t<mtime>" for each alignment file and for the reference and regions files
+//   (fingerprints of the inputs), and one line "options\t..." with all options changing the output
+// - "units\t<number of units>" and "done\t<number of units written>\t<size of the output after these units>"
+// - "run\t<length>\t<counts>": the run of the run-length format still pending after these units (length 0: none), which is not in the output
+// The output is synced to disk before the checkpoint is replaced atomically (written to a temporary file renamed over the previous one),
+// so the output always holds at least the units recorded in the checkpoint. Units written after the last checkpoint are discarded on resume
+class Checkpoint {
+
+    public:
+
+        // Build the manifest of the run from <parameters>. With <parameters.resume>, load the checkpoint of a previous run: it must have the
+        // same manifest. Without an existing checkpoint, the run starts from the beginning; otherwise, the checkpoint of a previous run is
+        // removed. Returns 1 on error
+        int open(const Parameters& parameters);
+
+        // Set the number of work units of the run, which must match a loaded checkpoint. Returns 1 on error
+        int set_units(uint n_units);
+
+        // Record that the first <n_written> units of this run (after the resumed units) are written to <out> through <output>, with the output
+        // state <state>. A checkpoint is written if the previous one is older than CHECKPOINT_INTERVAL, or for the last unit. Returns 1 on error
+        int record(uint n_written, std::ostream& out, FdOutput& output, const OutputState& state);
+
+        bool resumed = false;  // True if a checkpoint was loaded
+        uint resumed_units = 0;  // Number of units written by previous runs
+        uint64_t resumed_offset = 0;  // Size of the output written by previous runs
+        OutputState resumed_state;  // State of the output written by previous runs (pending run)
+
+    private:
+
+        int write(uint n_done, uint64_t offset, const OutputState& state);  // Replace the checkpoint file atomically. Returns 1 on error
+
+        std::string path;
+        std::string manifest;
+        uint n_units = 0;
+        std::chrono::steady_clock::time_point last_checkpoint;
+};
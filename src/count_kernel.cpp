@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "htslib/htslib/sam.h"
+#include "count_kernel.h"
+#include "nucleotides.h"
+
+
+void count_run_scalar(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length) {
+
+    uint32_t end = position + length;
+
+    if (min_quality > 0) {
+        for (; position < end; ++position, ++query_position) {
+            if (quality[query_position] >= min_quality) depths.increment(position, file_n, NT16_COLUMN[bam_seqi(sequence, query_position)]);
+        }
+        return;
+    }
+
+    // Sequence bytes hold two bases: decode a single base to start on a byte boundary, then two bases per byte, then the last base if any
+    if ((query_position & 1) && position < end) {
+        depths.increment(position, file_n, NT16_COLUMN[bam_seqi(sequence, query_position)]);
+        ++position;
+        ++query_position;
+    }
+    for (; position + 1 < end; position += 2, query_position += 2) {
+        uint8_t columns = NT16_PAIR_COLUMNS[sequence[query_position >> 1]];
+        depths.increment(position, file_n, columns & 0xf);
+        depths.increment(position + 1, file_n, columns >> 4);
+    }
+    if (position < end) depths.increment(position, file_n, NT16_COLUMN[bam_seqi(sequence, query_position)]);
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// The counters of KERNEL_BLOCK_SIZE consecutive positions are a contiguous span of KERNEL_BLOCK_SIZE * N_COUNTERS bytes (rows of N_COUNTERS counters).
+// For each byte of the span, KERNEL_ROWS gives its row (base index in the block) and KERNEL_COLUMNS its column: the byte is incremented
+// if the column of the base in its row is its column. Both tables are generated with initializer macros
+#define KERNEL_SPAN (KERNEL_BLOCK_SIZE * N_COUNTERS)
+#define KERNEL_ROWS_4(i) (i) / N_COUNTERS, (i + 1) / N_COUNTERS, (i + 2) / N_COUNTERS, (i + 3) / N_COUNTERS
+#define KERNEL_ROWS_16(i) KERNEL_ROWS_4(i), KERNEL_ROWS_4(i + 4), KERNEL_ROWS_4(i + 8), KERNEL_ROWS_4(i + 12)
+#define KERNEL_COLUMNS_4(i) (i) % N_COUNTERS, (i + 1) % N_COUNTERS, (i + 2) % N_COUNTERS, (i + 3) % N_COUNTERS
+#define KERNEL_COLUMNS_16(i) KERNEL_COLUMNS_4(i), KERNEL_COLUMNS_4(i + 4), KERNEL_COLUMNS_4(i + 8), KERNEL_COLUMNS_4(i + 12)
+
+alignas(32) static const uint8_t KERNEL_ROWS[KERNEL_SPAN] = {KERNEL_ROWS_16(0), KERNEL_ROWS_16(16), KERNEL_ROWS_16(32), KERNEL_ROWS_16(48), KERNEL_ROWS_16(64), KERNEL_ROWS_16(80)};
+alignas(32) static const uint8_t KERNEL_COLUMNS[KERNEL_SPAN] = {KERNEL_COLUMNS_16(0), KERNEL_COLUMNS_16(16), KERNEL_COLUMNS_16(32), KERNEL_COLUMNS_16(48), KERNEL_COLUMNS_16(64), KERNEL_COLUMNS_16(80)};
+
+static_assert(KERNEL_BLOCK_SIZE == 16 && KERNEL_SPAN == 96, "Vector kernels are written for blocks of 16 bases with 6 counters per row");
+static_assert(COUNTER_SATURATED == UINT8_MAX, "Vector kernels rely on unsigned saturating adds to detect saturated counters");
+
+
+// Columns of 16 bases starting at an even <query_position>: the 8 packed bytes are split into high and low 4-bit codes,
+// interleaved back in sequence order and converted to columns with a byte shuffle on the NT16_COLUMN table
+__attribute__((target("sse4.2")))
+static inline __m128i block_columns(const uint8_t *sequence, uint32_t query_position) {
+
+    const __m128i low_bits = _mm_set1_epi8(0x0f);
+    __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sequence + (query_position >> 1)));
+    __m128i codes = _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(packed, 4), low_bits), _mm_and_si128(packed, low_bits));
+
+    return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(NT16_COLUMN)), codes);
+}
+
+
+// Mask the columns of bases with a quality lower than <threshold> (16 copies of the minimum quality) for a block of 16 bases.
+// Their column is set to 0xff, which matches no counter, so low quality bases are skipped without a branch
+__attribute__((target("sse4.2")))
+static inline __m128i mask_low_quality(__m128i columns, const uint8_t *quality, __m128i threshold) {
+
+    __m128i qualities = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quality));
+    __m128i passed = _mm_cmpeq_epi8(_mm_max_epu8(qualities, threshold), qualities);  // Unsigned quality >= threshold
+
+    return _mm_or_si128(columns, _mm_andnot_si128(passed, _mm_set1_epi8(-1)));
+}
+
+
+// Counters that were already saturated before a vector add did not change: count them in the overflow blocks.
+// <saturated> has bit i set if byte i of the span starting at <offset> was saturated and incremented
+static inline void count_saturated(DepthMatrix& depths, uint file_n, uint32_t position, uint offset, uint32_t saturated) {
+
+    while (saturated) {
+        uint byte = offset + static_cast<uint>(__builtin_ctz(saturated));
+        depths.increment(position + byte / N_COUNTERS, file_n, byte % N_COUNTERS);  // The counter is still COUNTER_SATURATED, so this goes to its overflow block
+        saturated &= saturated - 1;
+    }
+}
+
+
+__attribute__((target("sse4.2")))
+void count_run_sse42(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length) {
+
+    const __m128i ones = _mm_set1_epi8(1), full = _mm_set1_epi8(static_cast<char>(COUNTER_SATURATED));
+    const __m128i threshold = _mm_set1_epi8(static_cast<char>(min_quality));
+
+    if ((query_position & 1) && length > 0) {  // Start on a sequence byte boundary
+        count_run_scalar(depths, file_n, position, sequence, quality, min_quality, query_position, 1);
+        ++position;
+        ++query_position;
+        --length;
+    }
+
+    // Blocks are only counted with vectors when their rows are contiguous (they are not split by the end of a circular window)
+    while (length >= KERNEL_BLOCK_SIZE && depths.contiguous_rows(position) >= KERNEL_BLOCK_SIZE) {
+        __m128i columns = block_columns(sequence, query_position);
+        if (min_quality > 0) columns = mask_low_quality(columns, quality + query_position, threshold);
+        uint8_t *cells = depths.cells(position, file_n);
+        for (uint offset = 0; offset < KERNEL_SPAN; offset += 16) {
+            __m128i hits = _mm_cmpeq_epi8(_mm_shuffle_epi8(columns, _mm_load_si128(reinterpret_cast<const __m128i*>(KERNEL_ROWS + offset))),
+                                          _mm_load_si128(reinterpret_cast<const __m128i*>(KERNEL_COLUMNS + offset)));
+            __m128i counters = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + offset));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(cells + offset), _mm_adds_epu8(counters, _mm_and_si128(hits, ones)));
+            uint32_t saturated = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(counters, full), hits)));
+            if (saturated) count_saturated(depths, file_n, position, offset, saturated);
+        }
+        position += KERNEL_BLOCK_SIZE;
+        query_position += KERNEL_BLOCK_SIZE;
+        length -= KERNEL_BLOCK_SIZE;
+    }
+
+    count_run_scalar(depths, file_n, position, sequence, quality, min_quality, query_position, length);
+}
+
+
+__attribute__((target("avx2")))
+void count_run_avx2(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length) {
+
+    const __m256i ones = _mm256_set1_epi8(1), full = _mm256_set1_epi8(static_cast<char>(COUNTER_SATURATED));
+    const __m128i threshold = _mm_set1_epi8(static_cast<char>(min_quality));
+
+    if ((query_position & 1) && length > 0) {  // Start on a sequence byte boundary
+        count_run_scalar(depths, file_n, position, sequence, quality, min_quality, query_position, 1);
+        ++position;
+        ++query_position;
+        --length;
+    }
+
+    // Same as the SSE kernel with 32-byte vectors. Byte shuffles only work within 128-bit lanes, so the columns are copied to both lanes
+    while (length >= KERNEL_BLOCK_SIZE && depths.contiguous_rows(position) >= KERNEL_BLOCK_SIZE) {
+        __m128i block = block_columns(sequence, query_position);
+        if (min_quality > 0) block = mask_low_quality(block, quality + query_position, threshold);
+        __m256i columns = _mm256_broadcastsi128_si256(block);
+        uint8_t *cells = depths.cells(position, file_n);
+        for (uint offset = 0; offset < KERNEL_SPAN; offset += 32) {
+            __m256i hits = _mm256_cmpeq_epi8(_mm256_shuffle_epi8(columns, _mm256_load_si256(reinterpret_cast<const __m256i*>(KERNEL_ROWS + offset))),
+                                             _mm256_load_si256(reinterpret_cast<const __m256i*>(KERNEL_COLUMNS + offset)));
+            __m256i counters = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cells + offset));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(cells + offset), _mm256_adds_epu8(counters, _mm256_and_si256(hits, ones)));
+            uint32_t saturated = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(counters, full), hits)));
+            if (saturated) count_saturated(depths, file_n, position, offset, saturated);
+        }
+        position += KERNEL_BLOCK_SIZE;
+        query_position += KERNEL_BLOCK_SIZE;
+        length -= KERNEL_BLOCK_SIZE;
+    }
+
+    count_run_scalar(depths, file_n, position, sequence, quality, min_quality, query_position, length);
+}
+
+#endif
+
+
+typedef void (*CountRunFunction)(DepthMatrix&, uint, uint32_t, const uint8_t*, const uint8_t*, uint8_t, uint32_t, uint32_t);
+
+struct CountKernel {
+    const char *name;
+    CountRunFunction function;
+};
+
+
+// Select the fastest kernel supported by the CPU running the program, so that a single binary runs on all x86 CPUs, or the kernel named
+// by KERNEL_ENV
+static CountKernel select_kernel() {
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *forced = getenv(KERNEL_ENV);
+    auto allowed = [&](const char *name) { return forced == nullptr || forced[0] == '\0' || strcmp(forced, name) == 0; };
+    __builtin_cpu_init();  // Required before __builtin_cpu_supports during static initialization
+    if (allowed("avx2") && __builtin_cpu_supports("avx2")) return {"avx2", count_run_avx2};
+    if (allowed("sse4.2") && __builtin_cpu_supports("sse4.2")) return {"sse4.2", count_run_sse42};
+#endif
+
+    return {"scalar", count_run_scalar};
+}
+
+static const CountKernel kernel = select_kernel();
+
+
+void count_run(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length) {
+
+    kernel.function(depths, file_n, position, sequence, quality, min_quality, query_position, length);
+}
+
+
+const char* count_kernel_name() {
+
+    return kernel.name;
+}
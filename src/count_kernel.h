@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include "depth_matrix.h"
+
+// Number of bases counted in each step of the vector kernels
+#define KERNEL_BLOCK_SIZE 16
+
+// Environment variable restricting the kernel selected at startup to the one with this name, e.g. "scalar" to compare the vector kernels
+// with it (test/test_kernels.sh). A kernel not supported by the CPU, or an unknown name, falls back to the scalar kernel
+#define KERNEL_ENV "PILEUP_KERNEL"
+
+
+// Count <length> consecutive aligned bases (a M, = or X run) of file <file_n>: base <query_position> of the packed 4-bit <sequence>
+// is aligned at <position>, the next one at <position> + 1, etc. Bases with a quality (from <quality>, indexed like the sequence) lower than
+// <min_quality> are not counted; with <min_quality> = 0, <quality> is not read. Uses the fastest kernel supported by the CPU, selected once at startup
+void count_run(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length);
+
+// Name of the kernel used by count_run ("avx2", "sse4.2" or "scalar"), reported at startup
+const char* count_kernel_name();
+
+// Kernel variants, same arguments as count_run. The vector variants must only be called if the CPU supports them
+void count_run_scalar(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length);
+#if defined(__x86_64__) || defined(__i386__)
+void count_run_sse42(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length);
+void count_run_avx2(DepthMatrix& depths, uint file_n, uint32_t position, const uint8_t *sequence, const uint8_t *quality, uint8_t min_quality, uint32_t query_position, uint32_t length);
+#endif
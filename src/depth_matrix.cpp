@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include "depth_matrix.h"
+
+
+DepthMatrix::DepthMatrix(uint n_files) {
+
+    this->n_files = n_files;
+    this->n_rows = 0;
+    this->origin = 0;
+    this->data = nullptr;
+    this->capacity = 0;
+    this->block_size = 0;
+    this->mask = UINT32_MAX;
+    this->overflow.resize(n_files);
+}
+
+
+DepthMatrix::~DepthMatrix() {
+
+    free(this->data);
+}
+
+
+int DepthMatrix::allocate(uint32_t n_rows) {
+
+    // Round the size of each file block up to a multiple of the alignment so that all blocks start on a cache line
+    this->block_size = (static_cast<size_t>(n_rows) * N_COUNTERS + DEPTH_MATRIX_ALIGNMENT - 1) / DEPTH_MATRIX_ALIGNMENT * DEPTH_MATRIX_ALIGNMENT;
+    size_t size = this->block_size * this->n_files;
+
+    // Only reallocate when the current buffer is too small, otherwise the buffer from the previous contig is reused
+    if (size > this->capacity) {
+        free(this->data);
+        this->data = nullptr;
+        this->capacity = 0;
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, DEPTH_MATRIX_ALIGNMENT, size) != 0) {
+            std::cerr << "Error: could not allocate depth matrix for " << n_rows << " positions" << std::endl;
+            this->n_rows = 0;
+            this->block_size = 0;
+            return 1;
+        }
+        this->data = static_cast<uint8_t*>(buffer);
+        this->capacity = size;
+    }
+
+    return 0;
+}
+
+
+int DepthMatrix::reset(uint32_t n_rows, uint32_t origin) {
+
+    if (this->allocate(n_rows) != 0) return 1;
+
+    memset(this->data, 0, this->block_size * this->n_files);
+    this->n_rows = n_rows;
+    this->origin = origin;
+    this->mask = UINT32_MAX;
+    this->reset_overflow();
+
+    return 0;
+}
+
+
+void DepthMatrix::reset_overflow() {
+
+    uint32_t n_blocks = (this->n_rows + OVERFLOW_BLOCK_ROWS - 1) >> OVERFLOW_BLOCK_SHIFT;
+    for (auto& file_overflow: this->overflow) {
+        file_overflow.slots.assign(n_blocks, 0);
+        file_overflow.n_used = 0;
+    }
+}
+
+
+uint32_t DepthMatrix::promote(uint file_n) {
+
+    // Blocks are reused from previous contigs when possible, and zeroed when promoted
+    Overflow& file_overflow = this->overflow[file_n];
+    size_t block_counts = static_cast<size_t>(OVERFLOW_BLOCK_ROWS) * N_COUNTERS;
+    size_t first = static_cast<size_t>(file_overflow.n_used) * block_counts;
+    if (file_overflow.counts.size() < first + block_counts) {
+        file_overflow.counts.resize(first + block_counts, 0);
+    } else {
+        std::fill_n(file_overflow.counts.begin() + static_cast<std::ptrdiff_t>(first), block_counts, 0);
+    }
+
+    return ++file_overflow.n_used;
+}
+
+
+int DepthMatrix::reset_window(uint32_t size) {
+
+    if (this->reset(size) != 0) return 1;
+
+    this->mask = size - 1;
+
+    return 0;
+}
+
+
+int DepthMatrix::resize_window(uint32_t size, uint32_t first) {
+
+    if (size <= this->n_rows) return 0;
+
+    // Copy the rows in use to a temporary buffer in position order, then put them back at their row in the larger window.
+    // Overflow counts are indexed by row: the counts of saturated counters are saved in position order as well
+    uint32_t old_size = this->n_rows;
+    uint8_t *rows = static_cast<uint8_t*>(malloc(static_cast<size_t>(old_size) * N_COUNTERS * this->n_files));
+    if (rows == nullptr) {
+        std::cerr << "Error: could not allocate depth matrix for " << size << " positions" << std::endl;
+        return 1;
+    }
+    uint8_t *saved = rows;
+    std::vector<uint32_t> saved_overflow;  // Overflow counts of the saturated counters, in the order of the saved rows
+    for (uint f=0; f<this->n_files; ++f) {
+        for (uint32_t i=0; i<old_size; ++i, saved += N_COUNTERS) {
+            memcpy(saved, this->cells(first + i, f), N_COUNTERS);
+            for (uint l=0; l<N_COUNTERS; ++l) {
+                if (saved[l] == COUNTER_SATURATED) saved_overflow.push_back(this->overflow_count(first + i, f, l));
+            }
+        }
+    }
+
+    if (this->reset_window(size) != 0) {
+        free(rows);
+        return 1;
+    }
+
+    saved = rows;
+    auto saved_count = saved_overflow.begin();
+    for (uint f=0; f<this->n_files; ++f) {
+        for (uint32_t i=0; i<old_size; ++i, saved += N_COUNTERS) {
+            memcpy(this->cells(first + i, f), saved, N_COUNTERS);
+            for (uint l=0; l<N_COUNTERS; ++l) {
+                if (saved[l] != COUNTER_SATURATED) continue;
+                uint32_t count = *saved_count++;
+                if (count > 0) *this->overflow_cell(first + i, f, l) = count;
+            }
+        }
+    }
+    free(rows);
+
+    return 0;
+}
+
+
+void DepthMatrix::clear_rows(uint32_t start, uint32_t end) {
+
+    // Clear contiguous blocks of rows in each file block; in a circular window the range can wrap around the end of the block.
+    // The overflow counts of these rows are cleared in the promoted overflow blocks they overlap
+    while (start < end) {
+        uint32_t first_row = (start - this->origin) & this->mask;
+        uint32_t n = std::min(end - start, this->n_rows - first_row);
+        for (uint f=0; f<this->n_files; ++f) {
+            memset(this->cells(start, f), 0, static_cast<size_t>(n) * N_COUNTERS);
+            Overflow& file_overflow = this->overflow[f];
+            if (file_overflow.n_used == 0) continue;
+            for (uint32_t row=first_row; row<first_row + n; row=(row | (OVERFLOW_BLOCK_ROWS - 1)) + 1) {
+                uint32_t slot = file_overflow.slots[row >> OVERFLOW_BLOCK_SHIFT];
+                if (slot == 0) continue;
+                uint32_t block_end = std::min(first_row + n, (row | (OVERFLOW_BLOCK_ROWS - 1)) + 1);
+                size_t offset = (static_cast<size_t>(slot - 1) * OVERFLOW_BLOCK_ROWS + (row & (OVERFLOW_BLOCK_ROWS - 1))) * N_COUNTERS;
+                std::fill_n(file_overflow.counts.begin() + static_cast<std::ptrdiff_t>(offset), static_cast<size_t>(block_end - row) * N_COUNTERS, 0);
+            }
+        }
+        start += n;
+    }
+}
+
+
+void DepthMatrix::decrement(uint32_t position, uint file_n, uint column) {
+
+    // A saturated counter with an overflow count is decremented in its overflow block
+    uint8_t &cell = this->cells(position, file_n)[column];
+    if (cell == COUNTER_SATURATED && this->overflow_count(position, file_n, column) > 0) {
+        --*this->overflow_cell(position, file_n, column);
+        return;
+    }
+    --cell;
+}
+
+
+uint32_t DepthMatrix::overflow_count(uint32_t position, uint file_n, uint column) const {
+
+    const Overflow& file_overflow = this->overflow[file_n];
+    uint32_t row = (position - this->origin) & this->mask;
+    uint32_t slot = file_overflow.slots[row >> OVERFLOW_BLOCK_SHIFT];
+    if (slot == 0) return 0;
+
+    return file_overflow.counts[(static_cast<size_t>(slot - 1) * OVERFLOW_BLOCK_ROWS + (row & (OVERFLOW_BLOCK_ROWS - 1))) * N_COUNTERS + column];
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <vector>
+
+// Number of counters stored for each file at each position: nA, nT, nC, nG, nN, nOther
+#define N_COUNTERS 6
+
+// Alignment of the counters buffer and of each file block (one cache line)
+#define DEPTH_MATRIX_ALIGNMENT 64
+
+// Value of a saturated 8-bit counter. Counts above this value are stored in the overflow blocks
+#define COUNTER_SATURATED UINT8_MAX
+
+// Number of rows in an overflow block (power of two): a block of 32-bit counts is allocated for these rows when one of their counters saturates
+#define OVERFLOW_BLOCK_SHIFT 10
+#define OVERFLOW_BLOCK_ROWS (1u << OVERFLOW_BLOCK_SHIFT)
+
+
+// Depth counters for a range of positions stored in a single contiguous buffer.
+// The buffer is split into one block per input file; in each block, a row holds the N_COUNTERS counters of one reference position.
+// Blocks start on a cache line boundary so that threads counting different files never write to the same cache line.
+// The buffer is allocated once and reused for every contig: it only grows when more rows than ever before are needed.
+// The matrix either holds a range of positions starting at <origin> (row i = position origin + i, for a whole contig or a chunk of a contig),
+// or is used as a circular window of power-of-two size (row = position % n_rows).
+//
+// Counters are 8-bit, which is enough for most positions. When a counter reaches COUNTER_SATURATED, its block of OVERFLOW_BLOCK_ROWS rows is
+// promoted: a dense block of 32-bit counts is allocated for these rows in the file's overflow storage, and further increments go to the count
+// of the counter in this block (found by array indexing, no hashing). The value is COUNTER_SATURATED + the overflow count, so counts are exact
+// at any depth. Overflow blocks are indexed by row, and cleared by row range with the rows.
+class DepthMatrix {
+
+    public:
+
+        DepthMatrix(uint n_files);
+        ~DepthMatrix();
+
+        DepthMatrix(const DepthMatrix&) = delete;
+        DepthMatrix& operator=(const DepthMatrix&) = delete;
+
+        // Prepare the matrix for <n_rows> positions starting at <origin> with all counters set to 0. Returns 1 if the buffer could not be allocated
+        int reset(uint32_t n_rows, uint32_t origin=0);
+
+        // Prepare the matrix as a circular window of <size> rows (power of two) with all counters set to 0. Returns 1 if the buffer could not be allocated
+        int reset_window(uint32_t size);
+
+        // Grow a circular window to <size> rows (power of two), keeping the counters of positions [first, first + n_rows). Returns 1 if the buffer could not be allocated
+        int resize_window(uint32_t size, uint32_t first);
+
+        // Set all counters to 0 for positions [start, end)
+        void clear_rows(uint32_t start, uint32_t end);
+
+        // Pointer to the N_COUNTERS 8-bit counters of file <file_n> at <position>
+        inline uint8_t* cells(uint32_t position, uint file_n) { return this->data + file_n * this->block_size + static_cast<size_t>((position - this->origin) & this->mask) * N_COUNTERS; }
+        inline const uint8_t* cells(uint32_t position, uint file_n) const { return this->data + file_n * this->block_size + static_cast<size_t>((position - this->origin) & this->mask) * N_COUNTERS; }
+
+        // Number of rows stored contiguously from <position> to the end of the block (a circular window wraps around after this)
+        inline uint32_t contiguous_rows(uint32_t position) const { return this->n_rows - ((position - this->origin) & this->mask); }
+
+        // Increment counter <column> of file <file_n> at <position>. Different files can be incremented concurrently
+        inline void increment(uint32_t position, uint file_n, uint column) {
+            uint8_t &cell = this->cells(position, file_n)[column];
+            if (cell != COUNTER_SATURATED) {
+                ++cell;
+            } else {
+                ++*this->overflow_cell(position, file_n, column);
+            }
+        }
+
+        // Decrement counter <column> of file <file_n> at <position>, which must be at least 1
+        void decrement(uint32_t position, uint file_n, uint column);
+
+        // Value of counter <column> of file <file_n> at <position>
+        inline uint32_t get(uint32_t position, uint file_n, uint column) const {
+            uint8_t cell = this->cells(position, file_n)[column];
+            return (cell != COUNTER_SATURATED) ? cell : COUNTER_SATURATED + this->overflow_count(position, file_n, column);
+        }
+
+        uint n_files;  // Number of input files
+        uint32_t n_rows;  // Number of rows in use (range length, or window size)
+        uint32_t origin;  // Position of the first row (0 for a circular window)
+
+    private:
+
+        // Overflow counts of one file: blocks of OVERFLOW_BLOCK_ROWS rows with N_COUNTERS 32-bit counts per row, allocated when promoted
+        struct Overflow {
+            std::vector<uint32_t> slots;  // For each block of rows, 1 + index of its block in <counts>, or 0 if the block was not promoted
+            std::vector<uint32_t> counts;  // Counts of the promoted blocks (kept allocated between contigs)
+            uint32_t n_used = 0;  // Number of blocks of <counts> in use
+        };
+
+        int allocate(uint32_t n_rows);  // Make sure the buffer can hold <n_rows> rows for each file, without preserving its content
+        void reset_overflow();  // Remove all overflow counts, keeping the storage of promoted blocks for reuse
+        uint32_t promote(uint file_n);  // Allocate a zeroed overflow block for file <file_n> and return 1 + its index
+        uint32_t overflow_count(uint32_t position, uint file_n, uint column) const;  // Count stored in the overflow blocks for a saturated counter
+
+        // Overflow count of counter <column> of file <file_n> at <position>, promoting its block of rows if needed
+        inline uint32_t* overflow_cell(uint32_t position, uint file_n, uint column) {
+            Overflow& file_overflow = this->overflow[file_n];
+            uint32_t row = (position - this->origin) & this->mask;
+            uint32_t& slot = file_overflow.slots[row >> OVERFLOW_BLOCK_SHIFT];
+            if (slot == 0) slot = this->promote(file_n);
+            return file_overflow.counts.data() + (static_cast<size_t>(slot - 1) * OVERFLOW_BLOCK_ROWS + (row & (OVERFLOW_BLOCK_ROWS - 1))) * N_COUNTERS + column;
+        }
+
+        uint8_t* data;  // Counters buffer, aligned to DEPTH_MATRIX_ALIGNMENT
+        size_t capacity;  // Number of counters allocated in the buffer
+        size_t block_size;  // Number of counters in the block of each file (n_rows * N_COUNTERS rounded up to DEPTH_MATRIX_ALIGNMENT)
+        uint32_t mask;  // Mask applied to positions to get a row index (all bits set for a whole contig)
+        std::vector<Overflow> overflow;  // For each file, counts above COUNTER_SATURATED
+};
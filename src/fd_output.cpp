@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+#include "fd_output.h"
+
+
+FdOutput::~FdOutput() {
+
+    if (this->fd >= 0) this->close();
+}
+
+
+int FdOutput::open(const char *path) {
+
+    this->path = path;
+
+    if (this->path == "-") {
+        this->fd = STDOUT_FILENO;
+    } else if ((this->fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        std::cerr << "Error opening output file <" << path << ">: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    this->buffer.resize(FD_OUTPUT_BUFFER_SIZE);
+    this->setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+
+    return 0;
+}
+
+
+int FdOutput::reopen(const char *path, uint64_t offset) {
+
+    this->path = path;
+
+    struct stat stats;
+    if ((this->fd = ::open(path, O_WRONLY)) < 0 || fstat(this->fd, &stats) != 0) {
+        std::cerr << "Error opening output file <" << path << ">: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    if (static_cast<uint64_t>(stats.st_size) < offset) {
+        std::cerr << "Error: output file <" << path << "> is shorter (" << stats.st_size << " bytes) than recorded in its checkpoint (" << offset << " bytes)" << std::endl;
+        return 1;
+    }
+
+    if (ftruncate(this->fd, static_cast<off_t>(offset)) != 0 || lseek(this->fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+        std::cerr << "Error truncating output file <" << path << ">: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    this->offset = offset;
+
+    this->buffer.resize(FD_OUTPUT_BUFFER_SIZE);
+    this->setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+
+    return 0;
+}
+
+
+int FdOutput::close() {
+
+    if (this->fd < 0) return 1;
+
+    int return_value = (this->write_buffer() != 0) ? 1 : 0;
+
+    if (this->fd != STDOUT_FILENO && ::close(this->fd) != 0) {
+        std::cerr << "Error closing output file <" << this->path << ">: " << strerror(errno) << std::endl;
+        return_value = 1;
+    }
+    this->fd = -1;
+
+    return return_value;
+}
+
+
+int FdOutput::commit(uint64_t& offset) {
+
+    if (this->write_buffer() != 0) return 1;
+
+    if (this->fd != STDOUT_FILENO && fdatasync(this->fd) != 0) {
+        std::cerr << "Error syncing output file <" << this->path << ">: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    offset = this->offset;
+
+    return 0;
+}
+
+
+int FdOutput::overflow(int c) {
+
+    if (this->write_buffer() != 0) return traits_type::eof();
+
+    if (c != traits_type::eof()) {
+        *this->pptr() = static_cast<char>(c);
+        this->pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+
+std::streamsize FdOutput::xsputn(const char *data, std::streamsize size) {
+
+    size_t length = static_cast<size_t>(size);
+
+    // Small writes are copied to the buffer; writes larger than the buffer (formatted units, pipeline blocks) are written directly
+    if (length > static_cast<size_t>(this->epptr() - this->pptr())) {
+        if (this->write_buffer() != 0) return 0;
+        if (length >= this->buffer.size()) return (this->write_all(data, length) != 0) ? 0 : size;
+    }
+
+    memcpy(this->pptr(), data, length);
+    this->pbump(static_cast<int>(length));
+
+    return size;
+}
+
+
+int FdOutput::sync() {
+
+    return (this->write_buffer() != 0) ? -1 : 0;
+}
+
+
+int FdOutput::write_all(const char *data, size_t size) {
+
+    if (this->failed) return 1;
+
+    while (size > 0) {
+        ssize_t written = ::write(this->fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error writing to output file <" << this->path << ">: " << strerror(errno) << std::endl;
+            this->failed = true;
+            return 1;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        this->offset += static_cast<uint64_t>(written);
+    }
+
+    return 0;
+}
+
+
+int FdOutput::write_buffer() {
+
+    size_t size = static_cast<size_t>(this->pptr() - this->pbase());
+    if (size > 0 && this->write_all(this->pbase(), size) != 0) return 1;
+
+    this->setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+
+    return this->failed ? 1 : 0;
+}
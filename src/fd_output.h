@@ -0,0 +1,54 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Size of the buffer collecting output before it is written to the file descriptor
+#define FD_OUTPUT_BUFFER_SIZE 1048576
+
+
+// Output stream buffer writing directly to a file descriptor with write(2), bypassing stdio and the std::cout synchronisation with it.
+// Data is collected in a large preallocated buffer and written in a few big system calls
+class FdOutput : public std::streambuf {
+
+    public:
+
+        FdOutput() {}
+        ~FdOutput();
+
+        FdOutput(const FdOutput&) = delete;
+        FdOutput& operator=(const FdOutput&) = delete;
+
+        // Open output to <path> ("-" for stdout), truncating an existing file. Returns 1 if the file could not be opened
+        int open(const char *path);
+
+        // Open the existing output file <path> to append to it after its first <offset> bytes, discarding the rest (output of an interrupted
+        // run written after its last checkpoint). Returns 1 if the file could not be opened or is shorter than <offset>
+        int reopen(const char *path, uint64_t offset);
+
+        // Write remaining data and close the file (stdout is only flushed). Returns 1 on error
+        int close();
+
+        // Write buffered data and wait until the file is on disk (stdout is only flushed). <offset>: size of the output written so far,
+        // all durable. Returns 1 on error
+        int commit(uint64_t& offset);
+
+    protected:
+
+        int overflow(int c) override;
+        std::streamsize xsputn(const char *data, std::streamsize size) override;
+        int sync() override;
+
+    private:
+
+        int write_all(const char *data, size_t size);  // Write <size> bytes to the file descriptor, retrying partial writes. Returns 1 on error
+        int write_buffer();  // Write the buffer content. Returns 1 on error
+
+        int fd = -1;
+        std::string path;
+        uint64_t offset = 0;  // Number of bytes in the file before the buffer
+        std::vector<char> buffer;
+        bool failed = false;
+};
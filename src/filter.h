@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include "htslib/htslib/sam.h"
+
+
+// Number of alignments read and rejected by the read filter for one input file.
+// Alignments overlapping several chunks of a contig are read (and counted here) once per chunk
+struct FilterStats {
+    uint64_t n_reads = 0;  // Alignments read
+    uint64_t n_flags = 0;  // Rejected because of their flags
+    uint64_t n_mapq = 0;  // Rejected because of their mapping quality
+    uint64_t n_length = 0;  // Rejected because of their aligned length
+};
+
+
+// Read-level filter applied to every alignment before counting. The default filter accepts all alignments
+struct ReadFilter {
+    uint16_t required_flags = 0;  // All these flags must be set (proper pair adds BAM_FPROPER_PAIR here)
+    uint16_t excluded_flags = 0;  // None of these flags can be set
+    uint8_t min_mapq = 0;  // Minimum mapping quality
+    uint32_t min_length = 0;  // Minimum number of reference positions covered by the alignment
+    uint8_t min_base_quality = 0;  // Bases with a lower quality are not counted (applied to each base by count_alignment, not by accept)
+    bool dedup_overlaps = false;  // Count positions covered by both mates of a pair once (see MateOverlaps)
+
+    // True if no alignment can be rejected by this filter (bases can still be skipped by <min_base_quality>)
+    bool empty() const { return this->required_flags == 0 && this->excluded_flags == 0 && this->min_mapq == 0 && this->min_length == 0; }
+
+    // Alignment fields (SAM_* flags) read when counting with this filter. CRAM decoding is restricted to these fields.
+    // Mate fields are also needed for the mate flags (BAM_FMUNMAP, BAM_FMREVERSE), which CRAM sets when resolving mates
+    int required_fields() const {
+        int fields = SAM_FLAG | SAM_RNAME | SAM_POS | SAM_CIGAR | SAM_SEQ;
+        if (this->min_mapq > 0) fields |= SAM_MAPQ;
+        if (this->min_base_quality > 0 || this->dedup_overlaps) fields |= SAM_QUAL;
+        if (this->dedup_overlaps) fields |= SAM_QNAME | SAM_RNEXT | SAM_PNEXT;
+        if ((this->required_flags | this->excluded_flags) & (BAM_FMUNMAP | BAM_FMREVERSE)) fields |= SAM_RNEXT | SAM_PNEXT;
+        return fields;
+    }
+
+    // Return true if the alignment passes the filter, otherwise update the rejection counters.
+    // Flags and mapping quality only use the fixed-size core fields; the CIGAR is only read for the length test, after all other tests passed
+    inline bool accept(const bam1_t *b, FilterStats& stats) const {
+        ++stats.n_reads;
+        if ((b->core.flag & this->required_flags) != this->required_flags || (b->core.flag & this->excluded_flags) != 0) {
+            ++stats.n_flags;
+            return false;
+        }
+        if (b->core.qual < this->min_mapq) {
+            ++stats.n_mapq;
+            return false;
+        }
+        if (this->min_length > 0 && bam_cigar2rlen(static_cast<int>(b->core.n_cigar), bam_get_cigar(b)) < static_cast<hts_pos_t>(this->min_length)) {
+            ++stats.n_length;
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,105 @@
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include "htslib/htslib/cram.h"
+#include "htslib/htslib/faidx.h"
+#include "input.h"
+
+
+void index_reference(const std::string& reference) {
+
+    std::string fai_path = reference + ".fai";
+    if (reference.empty() || access(reference.c_str(), F_OK) != 0 || access(fai_path.c_str(), F_OK) == 0) return;
+
+    std::cerr << "Warning: index file not found for reference file <" << reference << ">. Indexing reference" << std::endl;
+    if (fai_build(reference.c_str()) < 0) std::cerr << "Warning: could not build index for reference file <" << reference << ">" << std::endl;
+}
+
+
+// Set the reference of a CRAM file (its index is built by index_reference). Returns 1 if the reference could not be set
+static int set_reference(htsFile *sam, std::string &reference) {
+
+    // Add reference file path to file descriptor
+    std::string ref_option = "reference=" + reference; // Create the string "reference=<provided/path/to/ref>" to add as option to format in htsFile
+    hts_opt_add(reinterpret_cast<hts_opt **>(&sam->format.specific), ref_option.c_str());  // Add reference to htsFile
+    std::string fai_path = reference + ".fai";  // Create the string "<provided/path/to/ref.fai>"
+    if (hts_set_fai_filename(sam, fai_path.c_str()) < 0) {  // Set reference index path in file descriptor
+        std::cerr << "Error: could not load reference file <" << reference << ">" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// True if both headers have the same contigs (names and lengths) in the same order
+static bool same_contigs(const sam_hdr_t *a, const sam_hdr_t *b) {
+
+    if (a->n_targets != b->n_targets) return false;
+    for (int i=0; i<a->n_targets; ++i) {
+        if (a->target_len[i] != b->target_len[i] || strcmp(a->target_name[i], b->target_name[i]) != 0) return false;
+    }
+
+    return true;
+}
+
+
+// Open an alignment file in a format-agnostic way and fill an inputFile object with all the information
+int open_input(char *fn_in, inputFile *file, std::string &reference, uint16_t file_n, htsThreadPool *thread_pool, int required_fields, SharedReference *shared_reference, bool load_index) {
+
+    // Open alignment file and handle opening error
+    if ((file->sam = hts_open(fn_in, "r")) == nullptr) {
+        std::cerr << "Error opening alignment file <" << fn_in << ">" << std::endl;
+        return 1;
+    }
+
+    // CRAM files require a reference. The first CRAM file sets it up; other CRAM files with the same contigs use the reference store of
+    // the first one, so that each reference sequence is loaded and cached once for all decoders. The store maps sequences to the contig ids
+    // of the first file: files with contigs in another order load their own store
+    if (file->sam->is_cram) {
+        bool shared = (shared_reference != nullptr && shared_reference->refs != nullptr
+                       && same_contigs(cram_fd_get_header(file->sam->fp.cram), shared_reference->header));
+        if (!shared) {
+            if (set_reference(file->sam, reference) != 0) return 1;
+        } else if (hts_set_opt(file->sam, CRAM_OPT_SHARED_REF, shared_reference->refs) != 0) {
+            std::cerr << "Error sharing reference with alignment file <" << fn_in << ">" << std::endl;
+            return 1;
+        }
+        // Only decode the fields used for counting: read names, qualities, aux tags and MD/NM are otherwise reconstructed for every record
+        if (hts_set_opt(file->sam, CRAM_OPT_REQUIRED_FIELDS, required_fields) != 0 || hts_set_opt(file->sam, CRAM_OPT_DECODE_MD, 0) != 0) {
+            std::cerr << "Error setting decoding options for alignment file <" << fn_in << ">" << std::endl;
+            return 1;
+        }
+    }
+
+    // Decompression (BGZF blocks for BAM, slices for CRAM) runs on the process-wide thread pool shared by all input files
+    if (thread_pool != nullptr && thread_pool->pool != nullptr && hts_set_thread_pool(file->sam, thread_pool) < 0) {
+        std::cerr << "Error attaching thread pool to alignment file <" << fn_in << ">" << std::endl;
+        return 1;
+    }
+
+    // Read file header and handle errors
+    if ((file->header = sam_hdr_read(file->sam)) == nullptr) {
+        std::cerr << "Error reading header for alignment file <" << fn_in << ">" << std::endl;
+        return 1;
+    }
+
+    if (file->sam->is_cram && shared_reference != nullptr && shared_reference->refs == nullptr) {
+        shared_reference->refs = cram_get_refs(file->sam);
+        shared_reference->header = file->header;
+    }
+
+    file->file_n = file_n;
+    file->idx = nullptr;
+    if (!load_index) return 0;
+
+    file->idx = sam_index_load(file->sam, fn_in); // Load index for alignment file. Index name is automatically infered from alignment file name
+
+    // Handle error opening index for alignment file
+    if (file->idx == nullptr) {
+        std::cerr << "Alignment file <" << file->sam->fn << "> is not indexed. Index with 'samtools index " << file->sam->fn << "'" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <limits.h>
+#include <stdint.h>
+#include <string>
+#include "htslib/htslib/cram.h"
+#include "htslib/htslib/hts.h"
+#include "htslib/htslib/sam.h"
+#include "filter.h"
+
+
+// Simple structure holding all information about an input file
+struct inputFile {
+    htsFile *sam;  // Main file descriptor (for the alignment file)
+    hts_idx_t *idx;  // Index file descriptor (nullptr for a file read sequentially)
+    sam_hdr_t *header;  // Header information read directly from main file
+    uint16_t file_n;  // Input file number
+    FilterStats filter_stats;  // Alignments read and rejected by the read filter for this file
+};
+
+
+// Reference store shared by CRAM files. htslib maps the sequences of a store to the contig ids of one header, so only files with exactly
+// the same @SQ lines (names and lengths, in the same order) as the file which set up the store can share it
+struct SharedReference {
+    refs_t *refs = nullptr;  // Reference store of the first CRAM file opened
+    sam_hdr_t *header = nullptr;  // Header of this file, which stays open for the whole run
+};
+
+
+// Build the index of the reference file if it is missing, before any CRAM file is opened. A reference which cannot be indexed is only
+// reported: it is not needed without CRAM files, and CRAM files fail to open without it
+void index_reference(const std::string& reference);
+
+// Open an alignment file in a format-agnostic way and fill an inputFile object with all the information.
+// If <thread_pool> is given, decompression for this file runs on this pool. CRAM records are only decoded for <required_fields> (SAM_* flags).
+// If <shared_reference> is given, CRAM files with the same @SQ lines as the first CRAM file opened use its reference store; other CRAM files
+// load the reference themselves. Without <load_index>, the file is only read sequentially: it can be unindexed, or a stream ("-" for stdin)
+int open_input(char *fn_in, inputFile *file, std::string &reference, uint16_t file_n, htsThreadPool *thread_pool=nullptr, int required_fields=INT_MAX,
+               SharedReference *shared_reference=nullptr, bool load_index=true);
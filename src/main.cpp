@@ -2,134 +2,148 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 #include <algorithm>
 #include "htslib/htslib/sam.h"
-#include "htslib/faidx.h"
-
-
-// Simple structure holding all information about an input file
-struct inputFile {
-    htsFile *sam;  // Main file descriptor (for the alignment file)
-    hts_idx_t *idx;  // Index file descriptor
-    sam_hdr_t *header;  // Header information read directly from main file
-    uint16_t file_n;  // Input file number
+#include "htslib/htslib/thread_pool.h"
+#include "bgzf_output.h"
+#include "checkpoint.h"
+#include "count_kernel.h"
+#include "depth_matrix.h"
+#include "fd_output.h"
+#include "input.h"
+#include "output.h"
+#include "parameters.h"
+#include "pileup.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "regions.h"
+#include "scheduler.h"
+#include "sequential.h"
+#include "stream.h"
+#include "task_pool.h"
+#include "units.h"
+
+
+// Resources used to process contigs on one thread. htsFile objects cannot be shared between threads, so each worker opens its own copy of all input files
+struct Worker {
+    std::vector<inputFile> input;  // Alignment files, in output order
+    DepthMatrix depths;  // Allocated once and reused for all contigs (whole contig, or circular window in stream mode)
+    TaskPool pool;  // Threads counting input files concurrently
+    std::vector<SequentialReader> readers;  // Whole-file mode: alignment files read once from start to end, contig after contig
+    Worker(uint n_files, uint n_threads) : depths(n_files), pool(n_threads), readers(n_files) {}
 };
 
 
-// Open an alignment file in a format-agnostic way and fill an inputFile object with all the information
-int open_input(char *fn_in, inputFile *file, std::string &reference, uint16_t file_n) {
+// Open all alignment files for a worker, with decompression running on the shared <thread_pool> and CRAM decoding using the shared
+// <reference> store. Returns 1 if any file could not be opened
+int open_worker_input(Worker& worker, Parameters& parameters, htsThreadPool *thread_pool, SharedReference *reference) {
 
-    // Open alignment file and handle opening error
-    if ((file->sam = hts_open(fn_in, "r")) == nullptr) {
-        std::cerr << "Error opening alignment file <" << fn_in << ">" << std::endl;
-        return 1;
+    for (uint16_t i=0; i<parameters.alignment_files.size(); ++i) {
+        inputFile tmp;
+        if (open_input(parameters.alignment_files[i], &tmp, parameters.reference, i, thread_pool, parameters.filter.required_fields(), reference,
+                       !parameters.sequential && !parameters.whole_file) != 0) return 1;
+        worker.input.push_back(tmp);
     }
 
-    // CRAM files require a reference. Need to add the reference path and reference index path to the file descriptor
-    if (file->sam->is_cram) {
-        // Add reference file path to file descriptor
-        std::string ref_option = "reference=" + reference; // Create the string "reference=<provided/path/to/ref>" to add as option to format in htsFile
-        hts_opt_add(reinterpret_cast<hts_opt **>(&file->sam->format.specific), ref_option.c_str());  // Add reference to htsFile
-        std::string fai_path = reference + ".fai";  // Create the string "<provided/path/to/ref.fai>"
-        if (hts_set_fai_filename(file->sam, fai_path.c_str()) < 0) {  // Set reference index path in file descriptor
-            std::cerr << "Warning: index file not found for reference file <" << reference << ">. Indexing reference" << std::endl;
-            if (fai_build(reference.c_str()) < 0) {  // Build reference fasta index if missing
-                std::cerr << "Error: could not build index for reference file <" << reference << ">" << std::endl;
-                return 1;
-            }
+    // In whole-file mode, each file is positioned at its first alignment, then read along as contigs are counted in header order
+    if (parameters.whole_file) {
+        for (uint i=0; i<worker.input.size(); ++i) {
+            if (worker.readers[i].open(&worker.input[i], worker.input[0].header, parameters.filter) != 0) return 1;
         }
     }
 
-    // Read file header and handle errors
-    if ((file->header = sam_hdr_read(file->sam)) == nullptr) {
-        std::cerr << "Error reading header for alignment file <" << fn_in << ">" << std::endl;
-        return 1;
-    }
+    return 0;
+}
 
-    file->idx = sam_index_load(file->sam, fn_in); // Load index for alignment file. Index name is automatically infered from alignment file name
 
-    // Handle error opening index for alignment file
-    if (file->idx == nullptr) {
-        std::cerr << "Alignment file <" << file->sam->fn << "> is not indexed. Index with 'samtools index " << file->sam->fn << "'" << std::endl;
-        return 1;
+// Print the number of alignments rejected by the read filter for each file to stderr, summed over all workers
+void print_filter_stats(const std::vector<std::unique_ptr<Worker>>& workers, Parameters& parameters) {
+
+    std::cerr << "Read filter (alignments read / rejected by flags, mapping quality, aligned length):" << std::endl;
+    for (uint i=0; i<parameters.alignment_files.size(); ++i) {
+        FilterStats total;
+        for (auto& worker: workers) {
+            const FilterStats& stats = worker->input[i].filter_stats;
+            total.n_reads += stats.n_reads;
+            total.n_flags += stats.n_flags;
+            total.n_mapq += stats.n_mapq;
+            total.n_length += stats.n_length;
+        }
+        std::cerr << "  " << parameters.alignment_files[i] << ": " << total.n_reads << " / " << total.n_flags << ", " << total.n_mapq << ", " << total.n_length << std::endl;
     }
+}
+
+
+// Process a unit made of several ranges (target regions, or batch of small contigs): its ranges are stored one after the other in the depth matrix
+// and output as separate regions
+int process_ranges_unit(Worker& worker, Parameters& parameters, const WorkUnit& unit, std::ostream& out, OutputState& state) {
 
-    file->file_n = file_n;
+    std::cerr << "Processing " << unit.ranges.size() << " ranges (" << unit.end << " bp)" << std::endl;
+
+    if (worker.depths.reset(unit.end, 0) != 0) return 1;
+
+    auto process = [&](uint k) { return process_ranges(&worker.input[k], unit.ranges, worker.input[0].header, worker.depths, parameters.filter); };
+    if (worker.pool.run(static_cast<uint>(worker.input.size()), process) != 0) return 1;
+
+    for (auto& range: unit.ranges) {
+        // The header of a target region split into several ranges is written with its first range only, as for chunks of a contig
+        if (range.start == range.region_start) {
+            const char *contig = worker.input[0].header->target_name[range.tid];
+            uint32_t region_len = range.region_end - range.region_start;
+            if (region_len == worker.input[0].header->target_len[range.tid]) {
+                write_region_header(out, contig, region_len, parameters.output_options.format, state);
+            } else {
+                std::string region = std::string(contig) + ":" + std::to_string(range.region_start + 1) + "-" + std::to_string(range.region_end);
+                write_region_header(out, region.c_str(), region_len, parameters.output_options.format, state);
+            }
+        }
+        write_rows(out, worker.depths, range.row, range.row + range.end - range.start, parameters.output_options, state, range.row - range.start);
+    }
 
     return 0;
 }
 
 
-int process_file(inputFile* input, char *region, std::vector<std::vector<uint16_t>>& depths, uint min_qual=0) {
+// Count all alignment files for a work unit (contig, chunk of a contig, or set of target ranges) and output depths for this unit. Format:
+// - 1 line with format "region=<region>\t<len=<region_length>" (for the first chunk of a contig only)
+// - for each position in the unit (in order), "nA, nT, nC, nG, nN, nOther" for each alignment file, alignment files are tab-separated
+//   (or the variable sites, run-length or binary format, see write_rows)
+// The output continues the output <state>
+int process_unit(Worker& worker, Parameters& parameters, const WorkUnit& unit, std::ostream& out, OutputState& state) {
 
-    hts_itr_t *iter = nullptr;
-    bam1_t *b = bam_init1();
-    int result;
+    if (!unit.ranges.empty()) return process_ranges_unit(worker, parameters, unit, out, state);
 
-    // sam_itr_querys parses the string given by <contig> to find the region with format `contig:start-end' and returns an iterator
-    if ((iter = sam_itr_querys(input->idx, input->header, region)) == nullptr) {
-        std::cerr << "Region <" << region << "> not found in index file";
-        return 1;
+    char *contig = worker.input[0].header->target_name[unit.tid];
+    uint32_t contig_len = worker.input[0].header->target_len[unit.tid];
+
+    if (unit.start == 0) {
+        std::cerr << "Processing contig " << contig << " (" << contig_len << " bp)" << std::endl;
+        write_region_header(out, contig, contig_len, parameters.output_options.format, state);
     }
 
-    uint32_t mapping_position = 0;
-    uint8_t *sequence = nullptr;
-    uint16_t mapping_quality = 0;
-    char nucleotide;
-    uint32_t *cigar = nullptr;
-
-    // Iterate through all alignments in the specified region
-    while ((result = sam_itr_next(input->sam, iter, b)) >= 0) {
-        mapping_quality = b->core.qual ;
-        if (mapping_quality < min_qual) continue;  // Skip reads with low mapping quality
-        mapping_position = static_cast<uint32_t>(b->core.pos);
-        sequence = bam_get_seq(b);
-        cigar = bam_get_cigar(b);
-        for (uint k = 0; k < b->core.n_cigar; ++k) {
-          uint op = bam_cigar_op(cigar[k]);
-          uint l = bam_cigar_oplen(cigar[k]);
-          if (op == BAM_CMATCH) {
-            for (uint j = mapping_position; j < mapping_position + l; ++j) {
-                nucleotide = seq_nt16_str[bam_seqi(sequence, j - mapping_position)]; // Get nucleotide id from read sequence and convert it to <ATGCN>.
-                switch (nucleotide) {
-                    case 'A':
-                        ++depths[j][input->file_n * 6];
-                        break;
-                    case 'T':
-                        ++depths[j][input->file_n * 6 + 1];
-                        break;
-                    case 'C':
-                        ++depths[j][input->file_n * 6 + 2];
-                        break;
-                    case 'G':
-                        ++depths[j][input->file_n * 6 + 3];
-                        break;
-                    case 'N':
-                        ++depths[j][input->file_n * 6 + 4];
-                        break;
-                    default:
-                        ++depths[j][input->file_n * 6 + 5];
-                        break;
-                }
-            }
-            mapping_position += l;
-          } else if (op == BAM_CREF_SKIP || op == BAM_CDEL) {
-              mapping_position += l;
-          }
-        }
+    if (parameters.stream) {
+        // Positions are output as soon as all files have moved past them
+        return stream_region(worker.input, contig, unit.start, unit.end, worker.depths, worker.pool, out, parameters.filter, parameters.output_options, state);
     }
 
-    // Destroy objects
-    hts_itr_destroy(iter);
-    bam_destroy1(b);
+    // Depths: {position: [nA, nT, nC, nG, nN, nOther] * number of files}
+    if (worker.depths.reset(unit.end - unit.start, unit.start) != 0) return 1;
 
-    if (result < -1) {
-        std::cerr << "Error processing region <" << region << "> in file <" << input->sam->fn << "> due to truncated file or corrupt BAM index file";
-        return 1;
-    }
+    // Process each alignment file; files are counted concurrently, each in its own block of the depth matrix
+    // In whole-file mode, files are read from where the previous contig ended instead of creating an index iterator for each contig
+    auto process = [&](uint k) {
+        if (parameters.whole_file) return process_sequential(worker.readers[k], unit.tid, unit.end, worker.depths, parameters.filter);
+        return process_file(&worker.input[k], contig, unit.start, unit.end, worker.depths, parameters.filter);
+    };
+    if (worker.pool.run(static_cast<uint>(worker.input.size()), process) != 0) return 1;
+
+    write_rows(out, worker.depths, unit.start, unit.end, parameters.output_options, state);
 
     return 0;
 }
@@ -137,77 +151,181 @@ int process_file(inputFile* input, char *region, std::vector<std::vector<uint16_
 
 int main(int argc, char *argv[]) {
 
-    if (argc < 3) {
-        std::cerr << "Usage: test reference.fa in.<sam|bam|cram> [in2.<sam|bam|cram> ...]";
+    Parameters parameters;
+    if (parse_args(argc, argv, parameters) != 0) return 1;
+
+    std::cerr << "Counting kernel: " << count_kernel_name() << std::endl;
+
+    int main_return = 0;
+    uint n_files = static_cast<uint>(parameters.alignment_files.size());  // Number of alignment files to process
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<WorkUnit> units;  // Contigs, or chunks of contigs, in output order
+    std::vector<uint64_t> unit_sizes;
+    Prefetcher prefetcher;  // Readahead of the data of upcoming units (-A)
+    Checkpoint checkpoint;  // Units completed by this run and by the interrupted runs it resumes (-k, -K)
+    htsThreadPool thread_pool = {nullptr, 0};  // Decompression threads shared by all input files of all workers
+    SharedReference reference;  // Reference store shared by the CRAM files of all workers with the same contigs as the first one opened
+    uint64_t data_offset = 0;  // Offset of the first contig block in binary output
+    FdOutput fd_output;  // Uncompressed output, to a file or stdout
+    BgzfOutput bgzf_output;  // Compressed output (-z), to a file or stdout
+    std::ostream out(std::cout.rdbuf());  // Output stream, redirected to the uncompressed or compressed output
+    OutputState output_state;  // State of the output written in order (escaped counts of binary output, pending run of run-length output)
+    std::vector<OutputState> unit_states;  // With several workers, state of the output of each unit until it is written in order
+
+    if (parameters.decode_threads > 0 && (thread_pool.pool = hts_tpool_init(static_cast<int>(parameters.decode_threads))) == nullptr) {
+        std::cerr << "Error creating decompression thread pool" << std::endl;
         return 1;
     }
 
-    int main_return = 0;
-    char *contig = nullptr;
-    uint32_t contig_len = 0;
-    std::vector<std::vector<uint16_t>> depths;
-    uint n_files = static_cast<uint>(argc) - 2;  // Number of alignment files to process
+    // The checkpoint of an interrupted run is loaded before the output file is opened, to be reopened after its last recorded unit
+    if (parameters.checkpoint && checkpoint.open(parameters) != 0) {
+        main_return = 1;
+        goto end;
+    }
+
+    if (parameters.bgzf) {
+        if (bgzf_output.open(parameters.output.empty() ? "-" : parameters.output.c_str(), &thread_pool, parameters.output_options.format == OUTPUT_TEXT) != 0) {
+            main_return = 1;
+            goto end;
+        }
+        out.rdbuf(&bgzf_output);
+    } else if (checkpoint.resumed) {
+        if (fd_output.reopen(parameters.output.c_str(), checkpoint.resumed_offset) != 0) {
+            main_return = 1;
+            goto end;
+        }
+        out.rdbuf(&fd_output);
+    } else {
+        if (fd_output.open(parameters.output.empty() ? "-" : parameters.output.c_str()) != 0) {
+            main_return = 1;
+            goto end;
+        }
+        out.rdbuf(&fd_output);
+    }
 
-    std::string reference = argv[1];
+    index_reference(parameters.reference);  // Built once, before CRAM files load the reference
 
-    // Properly open all alignment files with all necessary information (header, indexes, reference ...) and store them in a vector
-    std::cout << "#Files";  // Comment line in output with names of all processed alignment files in order
-    std::vector<inputFile> input;
-    for (uint16_t i=2; i<argc; ++i) {
-        inputFile tmp;
-        if (open_input(argv[i], &tmp, reference, i - 2) != 0) {
+    // Properly open all alignment files with all necessary information (header, indexes, reference ...) for each worker
+    for (uint w=0; w<parameters.workers; ++w) {
+        workers.emplace_back(new Worker(n_files, parameters.threads));
+        if (open_worker_input(*workers.back(), parameters, &thread_pool, &reference) != 0) {
             main_return = 1;
             goto end;
         }
-        input.push_back(tmp);
-        std::cout << "\t" << argv[i];  // Output alignment file path to comment output string
     }
-    std::cout << "\n";
 
-    // Process all alignment files contig by contig to reduce memory usage
-    for (int i=0; i<input[0].header->n_targets; ++i) {
+    if (parameters.output_options.format == OUTPUT_BINARY) {
+        data_offset = write_binary_header(out, parameters.alignment_files, workers[0]->input[0].header);
+    } else if (!checkpoint.resumed) {  // The output of a resumed run already starts with this line
+        out << "#Files";  // Comment line in output with names of all processed alignment files in order
+        for (auto file: parameters.alignment_files) out << "\t" << file;  // Output alignment file path to comment output string
+        out << "\n";
+    }
 
-        contig = input[0].header->target_name[i];
-        contig_len = input[0].header->target_len[i];
+    // Inputs read sequentially are merged by position: all contigs are counted in one pass over each file
+    if (parameters.sequential) {
+        if (stream_files(workers[0]->input, workers[0]->depths, workers[0]->pool, out, parameters.filter, parameters.output_options, output_state) != 0) main_return = 1;
+        goto end;
+    }
 
-        std::cerr << "Processing contig " << contig << " (" << contig_len << " bp)" << std::endl;
+    // Process all alignment files contig by contig (or chunk by chunk for long contigs) to reduce memory usage
+    if (parameters.pipeline) {
+        // Units are the depth tiles of the pipeline, so whole contigs are also split by default to bound memory usage
+        units = make_units(workers[0]->input[0], (parameters.chunk_size > 0) ? parameters.chunk_size : PIPELINE_TILE_SIZE);
+        if (run_pipeline(workers[0]->input, units, parameters.filter, parameters.output_options, out, output_state) != 0) main_return = 1;
+        goto end;
+    }
 
-        // Depths: {position: [nA, nT, nG, nC, nN, nOther] * number of files}
-        depths.resize(0);
-        depths.resize(contig_len);
-        for (uint k=0; k<contig_len; ++k) {
-            depths[k].resize(6 * n_files);
+    if (!parameters.regions.empty()) {
+        // Target regions are packed into units of several ranges, each file being read once per unit with a multi-region iterator
+        uint32_t unit_size = (parameters.chunk_size > 0) ? parameters.chunk_size : REGION_UNIT_SIZE;
+        if (make_region_units(parameters.regions.c_str(), workers[0]->input[0].header, unit_size, units) != 0) {
+            main_return = 1;
+            goto end;
         }
+    } else {
+        // Small contigs are batched, except when contigs are streamed or read from whole files, which have no per-contig iterator cost
+        uint32_t batch_size = (parameters.stream || parameters.whole_file) ? 0 : parameters.batch_size;
+        units = make_units(workers[0]->input[0], parameters.chunk_size, batch_size);
+    }
 
-        // Process each alignment file
-        for (auto file: input) {
-            if (process_file(&file, contig, depths, 0) != 0) {
+    // Units recorded in the checkpoint of an interrupted run are already in the output
+    if (parameters.checkpoint) {
+        if (checkpoint.set_units(static_cast<uint>(units.size())) != 0) {
+            main_return = 1;
+            goto end;
+        }
+        if (checkpoint.resumed) {
+            std::cerr << "Resuming after " << checkpoint.resumed_units << " of " << units.size() << " units" << std::endl;
+            units.erase(units.begin(), units.begin() + checkpoint.resumed_units);
+            output_state = checkpoint.resumed_state;  // The pending run of the resumed units is continued or written by the next units
+        }
+    }
+
+    for (auto& unit: units) unit_sizes.push_back(unit.end - unit.start);
+
+    // Data of upcoming units is read ahead in the order in which units are processed
+    if (parameters.prefetch) {
+        std::vector<uint> order(units.size());
+        for (uint i=0; i<units.size(); ++i) order[i] = i;
+        if (parameters.workers > 1) order = schedule_order(unit_sizes);
+        if (prefetcher.start(workers[0]->input, units, order) != 0) {
+            main_return = 1;
+            goto end;
+        }
+    }
+
+    if (parameters.workers == 1) {
+        for (uint i=0; i<units.size(); ++i) {
+            if (parameters.prefetch) prefetcher.started(i);
+            if (process_unit(*workers[0], parameters, units[i], out, output_state) != 0 || (parameters.checkpoint && checkpoint.record(i + 1, out, fd_output, output_state) != 0)) {
                 main_return = 1;
                 goto end;
             }
         }
-
-        // Output depths for this region. Format:
-        // - 1 line with format "region=<region>\t<len=<region_length>"
-        // - for each position in region (in order), "nA, nT, nG, nC, nN, nOther" for each alignment file, alignment files are tab-separated
-        std::cout << "region=" << contig << "\tlen=" << contig_len << "\n";
-        for (uint j=0; j<contig_len; ++j) {
-            for (uint k=0; k<n_files; ++k) {
-                for (uint l=0; l<6; ++l) {
-                    std::cout << depths[j][l + 6 * k];
-                    if (l < 5) std::cout << ",";
-                }
-                (k < input.size() - 1) ? std::cout << "\t" : std::cout << "\n";
-            }
+    } else {
+        // Units are processed concurrently (largest first), each with its own output state, and their output is written in header order
+        unit_states.resize(units.size());
+        auto process = [&](uint worker_n, uint unit_n, std::ostream& out) {
+            if (parameters.prefetch) prefetcher.started(unit_n);
+            return process_unit(*workers[worker_n], parameters, units[unit_n], out, unit_states[unit_n]);
+        };
+        auto write = [&](std::ostream& out, uint unit_n, const std::string& output) {
+            append_output(out, output_state, unit_states[unit_n], output);
+            std::vector<std::pair<uint64_t, uint32_t>>().swap(unit_states[unit_n].escapes);  // Release memory for this unit
+        };
+        std::function<int(uint)> written = nullptr;  // Units are recorded in the checkpoint once written in order
+        if (parameters.checkpoint) written = [&](uint n_written) { return checkpoint.record(n_written, out, fd_output, output_state); };
+        if (run_scheduler(unit_sizes, parameters.workers, process, out, written, write) != 0) {
+            main_return = 1;
+            goto end;
         }
     }
 
 end:
-    for (auto f: input) {  // Destroy all created objects
-        if (f.sam) hts_close(f.sam);
-        if (f.header) sam_hdr_destroy(f.header);
-        if (f.idx) hts_idx_destroy(f.idx);
+    if (main_return == 0) flush_output(out, output_state);  // Last run of the run-length format
+    if (main_return == 0 && parameters.output_options.format == OUTPUT_BINARY) write_binary_index(out, data_offset, n_files, workers[0]->input[0].header, output_state);
+    if (main_return == 0 && !parameters.filter.empty()) print_filter_stats(workers, parameters);
+
+    out.flush();
+    if (!out) {
+        std::cerr << "Error writing output" << std::endl;
+        main_return = 1;
     }
+    if (parameters.bgzf && bgzf_output.close() != 0) main_return = 1;  // Closed before the thread pool it compresses on
+    if (!parameters.bgzf && fd_output.close() != 0) main_return = 1;
+
+    if (parameters.prefetch) prefetcher.stop();  // Stopped before the indexes it queries are destroyed
+
+    for (auto& worker: workers) {
+        for (auto f: worker->input) {  // Destroy all created objects
+            if (f.sam) hts_close(f.sam);
+            if (f.header) sam_hdr_destroy(f.header);
+            if (f.idx) hts_idx_destroy(f.idx);
+        }
+    }
+
+    if (thread_pool.pool) hts_tpool_destroy(thread_pool.pool);  // Only destroyed after all files using it are closed
 
     return main_return;
 }
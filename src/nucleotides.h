@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+
+// Column of the depth counters for each nucleotide (see N_COUNTERS)
+#define COLUMN_A 0
+#define COLUMN_T 1
+#define COLUMN_C 2
+#define COLUMN_G 3
+#define COLUMN_N 4
+#define COLUMN_OTHER 5
+
+
+// Column for a 4-bit nucleotide code from a BAM sequence ("=ACMGRSVTWYHKDBN", see seq_nt16_str): A, T, C, G, N, and all other codes in COLUMN_OTHER
+constexpr uint8_t nt16_column(uint8_t code) {
+    return (code == 1) ? COLUMN_A : (code == 8) ? COLUMN_T : (code == 2) ? COLUMN_C : (code == 4) ? COLUMN_G : (code == 15) ? COLUMN_N : COLUMN_OTHER;
+}
+
+// Columns for both nucleotides of a packed BAM sequence byte: first nucleotide (high 4 bits) in the low 4 bits, second nucleotide in the high 4 bits
+constexpr uint8_t nt16_pair_columns(uint8_t byte) {
+    return static_cast<uint8_t>(nt16_column(byte >> 4) | (nt16_column(byte & 0xf) << 4));
+}
+
+// Table initializers generated from the constexpr functions above (C++11 constexpr functions cannot fill an array)
+#define NT16_COLUMNS_4(i) nt16_column(i), nt16_column(i + 1), nt16_column(i + 2), nt16_column(i + 3)
+#define NT16_COLUMNS_16(i) NT16_COLUMNS_4(i), NT16_COLUMNS_4(i + 4), NT16_COLUMNS_4(i + 8), NT16_COLUMNS_4(i + 12)
+#define NT16_PAIRS_4(i) nt16_pair_columns(i), nt16_pair_columns(i + 1), nt16_pair_columns(i + 2), nt16_pair_columns(i + 3)
+#define NT16_PAIRS_16(i) NT16_PAIRS_4(i), NT16_PAIRS_4(i + 4), NT16_PAIRS_4(i + 8), NT16_PAIRS_4(i + 12)
+#define NT16_PAIRS_64(i) NT16_PAIRS_16(i), NT16_PAIRS_16(i + 16), NT16_PAIRS_16(i + 32), NT16_PAIRS_16(i + 48)
+
+// Column for each 4-bit nucleotide code
+constexpr uint8_t NT16_COLUMN[16] = {NT16_COLUMNS_16(0)};
+
+// Columns for both nucleotides of each packed sequence byte, decoded as in nt16_pair_columns
+constexpr uint8_t NT16_PAIR_COLUMNS[256] = {NT16_PAIRS_64(0), NT16_PAIRS_64(64), NT16_PAIRS_64(128), NT16_PAIRS_64(192)};
+
+static_assert(NT16_COLUMN[1] == COLUMN_A && NT16_COLUMN[8] == COLUMN_T && NT16_COLUMN[2] == COLUMN_C && NT16_COLUMN[4] == COLUMN_G && NT16_COLUMN[15] == COLUMN_N && NT16_COLUMN[0] == COLUMN_OTHER, "Invalid nt16 column table");
+static_assert(NT16_PAIR_COLUMNS[0x18] == (COLUMN_A | COLUMN_T << 4) && NT16_PAIR_COLUMNS[0xf3] == (COLUMN_N | COLUMN_OTHER << 4), "Invalid nt16 pair table");
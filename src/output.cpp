@@ -0,0 +1,295 @@
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "nucleotides.h"
+#include "output.h"
+
+// Number of positions converted in each call to out.write
+#define WRITE_ROWS 4096
+
+// Maximum size of the text of one file at one position: N_COUNTERS counts of up to 10 digits, each followed by a separator
+#define TEXT_FILE_MAX_SIZE (N_COUNTERS * 11)
+
+// Maximum size of the position or run length starting a line in variable sites and run-length formats: up to 10 digits and a tab
+#define TEXT_PREFIX_MAX_SIZE 11
+
+// Two-digit strings "00" to "99", used to convert counts to text two digits at a time
+static const char DIGIT_PAIRS[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+
+// Append an integer to a buffer as <width> little-endian bytes
+static inline void append_le(std::string& buffer, uint64_t value, uint width) {
+
+    for (uint i=0; i<width; ++i) buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+
+// Write the decimal text of a count at <p>, without locale or stream state. Returns a pointer past the last digit
+static inline char* format_count(char *p, uint32_t value) {
+
+    if (value < 10) {  // Most counts
+        *p = static_cast<char>('0' + value);
+        return p + 1;
+    }
+
+    char digits[10];
+    char *first = digits + sizeof(digits);
+    while (value >= 100) {
+        uint32_t pair = value % 100;
+        value /= 100;
+        first -= 2;
+        memcpy(first, DIGIT_PAIRS + 2 * pair, 2);
+    }
+    if (value >= 10) {
+        first -= 2;
+        memcpy(first, DIGIT_PAIRS + 2 * value, 2);
+    } else {
+        *--first = static_cast<char>('0' + value);
+    }
+
+    size_t n_digits = static_cast<size_t>(digits + sizeof(digits) - first);
+    memcpy(p, first, n_digits);
+    return p + n_digits;
+}
+
+
+// Write the text format line of <position> at <p>. Returns a pointer past the newline
+static inline char* format_row(char *p, const DepthMatrix& depths, uint32_t position) {
+
+    for (uint k=0; k<depths.n_files; ++k) {
+        for (uint l=0; l<N_COUNTERS; ++l) {
+            p = format_count(p, depths.get(position, k, l));
+            *p++ = ',';
+        }
+        p[-1] = (k < depths.n_files - 1) ? '\t' : '\n';  // Replaces the last comma
+    }
+
+    return p;
+}
+
+
+// Check whether a position is variable: at least two of A, T, C, G with min_allele_count bases, and a total depth of at least min_depth
+static inline bool is_variable(const DepthMatrix& depths, uint32_t position, const OutputOptions& options) {
+
+    uint32_t totals[N_COUNTERS] = {0};
+    for (uint k=0; k<depths.n_files; ++k) {
+        for (uint l=0; l<N_COUNTERS; ++l) totals[l] += depths.get(position, k, l);
+    }
+
+    uint n_alleles = 0;
+    uint32_t depth = 0;
+    for (uint l=0; l<N_COUNTERS; ++l) depth += totals[l];
+    for (uint l=COLUMN_A; l<=COLUMN_G; ++l) n_alleles += (totals[l] >= options.min_allele_count);
+
+    return n_alleles >= 2 && depth >= options.min_depth;
+}
+
+
+// Check whether two positions have the same counts in all files
+static inline bool same_counts(const DepthMatrix& depths, uint32_t first, uint32_t second) {
+
+    for (uint k=0; k<depths.n_files; ++k) {
+        const uint8_t *first_cells = depths.cells(first, k), *second_cells = depths.cells(second, k);
+        if (memcmp(first_cells, second_cells, N_COUNTERS) != 0) return false;
+        for (uint l=0; l<N_COUNTERS; ++l) {  // Saturated counters are equal only if their overflow counts are equal
+            if (first_cells[l] == COUNTER_SATURATED && depths.get(first, k, l) != depths.get(second, k, l)) return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Write the run pending in <state> at <p> and clear it. Returns a pointer past the newline
+static inline char* format_run(char *p, OutputState& state) {
+
+    p = format_count(p, state.run_length);
+    *p++ = '\t';
+    memcpy(p, state.run_counts.data(), state.run_counts.size());
+    state.run_length = 0;
+
+    return p + state.run_counts.size();
+}
+
+
+// Append a string to a buffer, preceded by its length as a little-endian uint32
+static inline void append_string(std::string& buffer, const char *value) {
+
+    uint32_t length = static_cast<uint32_t>(strlen(value));
+    append_le(buffer, length, 4);
+    buffer.append(value, length);
+}
+
+
+void write_region_header(std::ostream& out, const char *region, uint32_t region_len, OutputFormat format, OutputState& state) {
+
+    if (format == OUTPUT_BINARY) return;  // Contig blocks are located with the index
+
+    flush_output(out, state);  // The last run of the previous region ends here
+
+    out << "region=" << region << "\tlen=" << region_len << "\n";
+}
+
+
+void write_rows(std::ostream& out, const DepthMatrix& depths, uint32_t start, uint32_t end, const OutputOptions& options, OutputState& state, uint32_t offset) {
+
+    if (options.format == OUTPUT_BINARY) {
+        std::string buffer;
+        for (uint32_t first=start; first<end; first+=WRITE_ROWS) {
+            buffer.clear();
+            for (uint32_t j=first; j<std::min(end, first + WRITE_ROWS); ++j) {
+                for (uint k=0; k<depths.n_files; ++k) {
+                    for (uint l=0; l<N_COUNTERS; ++l, ++state.n_counts) {
+                        uint32_t count = depths.get(j, k, l);
+                        if (count >= BINARY_COUNT_ESCAPE) {
+                            state.escapes.emplace_back(state.n_counts, count);
+                            count = BINARY_COUNT_ESCAPE;
+                        }
+                        append_le(buffer, count, BINARY_COUNT_WIDTH);
+                    }
+                }
+            }
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        }
+        return;
+    }
+
+    // Lines are formatted into a buffer with format_count and written in large blocks, instead of one formatted stream insertion per count
+    size_t line_max_size = depths.n_files * TEXT_FILE_MAX_SIZE + TEXT_PREFIX_MAX_SIZE;
+    std::string buffer(static_cast<size_t>(std::min(end - start, static_cast<uint32_t>(WRITE_ROWS))) * line_max_size, '\0');
+    char *p = &buffer[0];
+    uint32_t j = start;
+
+    // The run left pending by the previous call continues if the first rows have the same counts, otherwise it is written first
+    if (options.format == OUTPUT_RLE && state.run_length > 0 && j < end) {
+        char *row_end = format_row(p, depths, j);
+        if (state.run_counts.compare(0, std::string::npos, p, static_cast<size_t>(row_end - p)) == 0) {
+            uint32_t span = 1;
+            while (j + span < end && same_counts(depths, j, j + span)) ++span;
+            state.run_length += span;
+            j += span;
+        }
+        if (j < end) p = format_run(p, state);
+    }
+
+    while (j < end) {
+        if (static_cast<size_t>(p - &buffer[0]) + line_max_size > buffer.size()) {
+            out.write(buffer.data(), p - buffer.data());
+            p = &buffer[0];
+        }
+        uint32_t span = 1;  // Number of positions in this line
+        if (options.format == OUTPUT_VARIANTS) {
+            if (!is_variable(depths, j, options)) {
+                ++j;
+                continue;
+            }
+            p = format_count(p, j - offset);
+            *p++ = '\t';
+        } else if (options.format == OUTPUT_RLE) {
+            while (j + span < end && same_counts(depths, j, j + span)) ++span;
+            if (j + span == end) {  // The last run is kept in the state (formatted at <p> to get its text), the next rows can continue it
+                state.run_length = span;
+                state.run_counts.assign(p, format_row(p, depths, j));
+                break;
+            }
+            p = format_count(p, span);
+            *p++ = '\t';
+        }
+        p = format_row(p, depths, j);
+        j += span;
+    }
+    if (p != &buffer[0]) out.write(buffer.data(), p - buffer.data());
+}
+
+
+void append_output(std::ostream& out, OutputState& state, OutputState& unit_state, const std::string& unit_output) {
+
+    // Escaped counts are indexed from the start of the unit in its own state
+    for (auto& escape: unit_state.escapes) state.escapes.emplace_back(state.n_counts + escape.first, escape.second);
+    state.n_counts += unit_state.n_counts;
+
+    // The pending run continues with the first run of the unit (its first line, or its own pending run if the unit is a single run)
+    // when they have the same counts; otherwise it is written before the unit
+    size_t skipped = 0;
+    if (state.run_length > 0) {
+        size_t tab = unit_output.find('\t');
+        if (!unit_output.empty()) {
+            if (unit_output[0] >= '0' && unit_output[0] <= '9' && unit_output.compare(tab + 1, state.run_counts.size(), state.run_counts) == 0) {
+                state.run_length += static_cast<uint32_t>(strtoul(unit_output.c_str(), nullptr, 10));
+                skipped = tab + 1 + state.run_counts.size();
+            }
+        } else if (unit_state.run_length > 0 && unit_state.run_counts == state.run_counts) {
+            state.run_length += unit_state.run_length;
+            unit_state.run_length = 0;
+        }
+    }
+    if (skipped < unit_output.size() || unit_state.run_length > 0) flush_output(out, state);
+
+    out.write(unit_output.data() + skipped, static_cast<std::streamsize>(unit_output.size() - skipped));
+    if (unit_state.run_length > 0) {
+        state.run_length = unit_state.run_length;
+        state.run_counts.swap(unit_state.run_counts);
+    }
+}
+
+
+void flush_output(std::ostream& out, OutputState& state) {
+
+    if (state.run_length == 0) return;
+
+    std::string line(TEXT_PREFIX_MAX_SIZE + state.run_counts.size(), '\0');
+    char *end = format_run(&line[0], state);
+    out.write(line.data(), end - line.data());
+}
+
+
+uint64_t write_binary_header(std::ostream& out, const std::vector<char*>& files, const sam_hdr_t *header) {
+
+    std::string buffer(BINARY_MAGIC, BINARY_MAGIC_SIZE);
+    append_le(buffer, BINARY_VERSION, 4);
+    append_le(buffer, BINARY_COUNT_WIDTH, 4);
+    append_le(buffer, N_COUNTERS, 4);
+    append_le(buffer, files.size(), 4);
+    append_le(buffer, static_cast<uint64_t>(header->n_targets), 4);
+    for (auto file: files) append_string(buffer, file);
+    for (int i=0; i<header->n_targets; ++i) {
+        append_string(buffer, header->target_name[i]);
+        append_le(buffer, header->target_len[i], 4);
+    }
+    while (buffer.size() % 8 != 0) buffer.push_back('\0');  // Contig blocks and the index start on 8-byte boundaries
+
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+    return buffer.size();
+}
+
+
+void write_binary_index(std::ostream& out, uint64_t data_offset, uint n_files, const sam_hdr_t *header, const OutputState& state) {
+
+    // Blocks have a fixed size, so their offsets follow from contig lengths
+    std::string buffer;
+    uint64_t offset = data_offset;
+    for (int i=0; i<header->n_targets; ++i) offset += static_cast<uint64_t>(header->target_len[i]) * n_files * N_COUNTERS * BINARY_COUNT_WIDTH;
+
+    // The escape table starts after the last block, padded to 8 bytes, and is followed by the index
+    while ((offset + buffer.size()) % 8 != 0) buffer.push_back('\0');
+    uint64_t escapes_offset = offset + buffer.size();
+    for (auto& escape: state.escapes) {
+        append_le(buffer, escape.first, 8);
+        append_le(buffer, escape.second, 4);
+        append_le(buffer, 0, 4);
+    }
+    uint64_t index_offset = offset + buffer.size();
+
+    offset = data_offset;
+    for (int i=0; i<header->n_targets; ++i) {
+        append_le(buffer, offset, 8);
+        offset += static_cast<uint64_t>(header->target_len[i]) * n_files * N_COUNTERS * BINARY_COUNT_WIDTH;
+    }
+    append_le(buffer, escapes_offset, 8);
+    append_le(buffer, state.escapes.size(), 8);
+    append_le(buffer, index_offset, 8);
+    buffer.append(BINARY_INDEX_MAGIC, BINARY_MAGIC_SIZE);
+
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "htslib/htslib/sam.h"
+#include "depth_matrix.h"
+
+// Magic bytes at the start of a binary output file, and at the end of its index
+#define BINARY_MAGIC "PLPDEPTH"
+#define BINARY_INDEX_MAGIC "PLPINDEX"
+#define BINARY_MAGIC_SIZE 8
+
+// Version of the binary output format
+#define BINARY_VERSION 2
+
+// Size in bytes of each count in binary output
+#define BINARY_COUNT_WIDTH 2
+
+// Value of a count of at least this value in binary output. The exact count is stored in the escape table
+#define BINARY_COUNT_ESCAPE UINT16_MAX
+
+
+// Output formats
+enum OutputFormat {
+    OUTPUT_TEXT,  // One line per position, counts as comma-separated text
+    OUTPUT_BINARY,  // Fixed-width little-endian counts that can be read in place (see write_binary_header)
+    OUTPUT_VARIANTS,  // Text lines for variable positions only, each starting with the position
+    OUTPUT_RLE  // Text lines for runs of positions with identical counts, each starting with the length of the run
+};
+
+
+// Output format and the thresholds used by the variable sites format
+struct OutputOptions {
+    OutputFormat format = OUTPUT_TEXT;
+    uint32_t min_allele_count = 1;  // Minimum count of a nucleotide (summed over all files) to be an allele of a variable position
+    uint32_t min_depth = 0;  // Minimum total depth (all counters of all files) of a variable position
+};
+
+
+// State of an output carried over successive calls to write_rows, which are made in output order. Units formatted separately (by concurrent
+// workers) are formatted with their own state, then appended to the output with append_output
+struct OutputState {
+    uint64_t n_counts = 0;  // Binary format: number of counts written
+    std::vector<std::pair<uint64_t, uint32_t>> escapes;  // Binary format: index among all counts written and value of escaped counts, in order
+    uint32_t run_length = 0;  // Run-length format: length of the last run, not written yet since the next rows can continue it (0: no run)
+    std::string run_counts;  // Run-length format: text format line of the counts of this run
+};
+
+
+// Output the header line for a region, after the pending run of <state>. Format: "region=<region>\tlen=<region_length>".
+// Nothing is written in binary format
+void write_region_header(std::ostream& out, const char *region, uint32_t region_len, OutputFormat format, OutputState& state);
+
+// Output depths for positions [start, end) of a depth matrix, in order:
+// - text format: for each position, "nA,nT,nC,nG,nN,nOther" for each alignment file, alignment files are tab-separated
+// - binary format: for each position, nA, nT, nC, nG, nN, nOther for each alignment file as BINARY_COUNT_WIDTH-byte little-endian integers;
+//   counts of at least BINARY_COUNT_ESCAPE are written as BINARY_COUNT_ESCAPE and recorded in <state> for the escape table
+// - variable sites format: for each position with at least two alleles (A, T, C, G with at least min_allele_count bases over all files)
+//   and a total depth of at least min_depth, "<position>\t" (0-based, in the contig: matrix position - <offset>) followed by the text format line
+// - run-length format: for each run of consecutive positions with identical counts in all files, "<run length>\t" followed by the text
+//   format line. The last run is kept in <state>, and continued by the rows of the next call: runs only end at region boundaries
+//   (see write_region_header and flush_output)
+// <offset> is the difference between matrix positions and contig positions, for units made of several ranges (see UnitRange)
+void write_rows(std::ostream& out, const DepthMatrix& depths, uint32_t start, uint32_t end, const OutputOptions& options, OutputState& state, uint32_t offset=0);
+
+// Write the output <unit_output> of a unit formatted with its own state <unit_state> to <out>, and add <unit_state> to the state of the output.
+// A run pending in <state> is continued by the first run of the unit if they have the same counts
+void append_output(std::ostream& out, OutputState& state, OutputState& unit_state, const std::string& unit_output);
+
+// Write the output held in <state> (pending run) at the end of the output
+void flush_output(std::ostream& out, OutputState& state);
+
+// Position index of BGZF-compressed text output (-z -o <file>), written to <file>.pidx next to the htslib block index <file>.gzi:
+// - POSITION_INDEX_MAGIC, then "\t<interval>" (POSITION_INDEX_INTERVAL)
+// - for each indexed line, in output order: "<contig>\t<position>\t<offset>", with the name of the contig (also for target regions, whose
+//   header holds "<contig>:<start>-<end>"), the 0-based position of the line in the contig, and the offset of the line in the uncompressed output.
+//   The first line of each region (whole contig or target region, -R) is indexed, then the lines of the positions multiple of <interval>
+// Regions of a contig are output in order and do not overlap (target regions are merged). To read position p of contig c, inside an output
+// region, take the last line of contig c with a position of at most p, seek to its offset with bgzf_useek (using the .gzi index), and skip
+// p - position lines. The position index is only written for the text format, in which each line is one position: the
+// variable sites format gives positions on its lines, the run-length format does not have a line per position, and the binary format has
+// its own index (see write_binary_index)
+
+// Output the header of a binary file. All integers are little-endian, strings are not null-terminated:
+// - BINARY_MAGIC (8 bytes), then uint32 values: BINARY_VERSION, BINARY_COUNT_WIDTH, N_COUNTERS, number of files, number of contigs
+// - for each file: uint32 name length, name
+// - for each contig of <header> (in output order): uint32 name length, name, uint32 contig length
+// - zero padding to a multiple of 8 bytes
+// The header is followed by one block per contig in header order (every position of the contig, as written by write_rows: position-major,
+// then file, then column), then by the escape table and the index (see write_binary_index). Returns the size of the header, which is the offset
+// of the first contig block
+uint64_t write_binary_header(std::ostream& out, const std::vector<char*>& files, const sam_hdr_t *header);
+
+// Output the end of a binary file, after the contig blocks:
+// - the escape table: for each count of at least BINARY_COUNT_ESCAPE in <state>, in file order, uint64 index of the count among all counts
+//   of the blocks (its offset from the first block divided by BINARY_COUNT_WIDTH), uint32 count, uint32 padding (0)
+// - the index: for each contig, uint64 offset of its block from the start of the file, then uint64 offset of the escape table, uint64 number
+//   of escaped counts, uint64 offset of the index, then BINARY_INDEX_MAGIC
+// A reader gets the index offset from the last 16 bytes of the file, and the count for a file and column at position p of a contig at:
+// block offset + ((p * number of files + file) * N_COUNTERS + column) * BINARY_COUNT_WIDTH. A count equal to BINARY_COUNT_ESCAPE is looked up
+// in the escape table (sorted by index, binary search). Counts are 16-bit because most depths are below 65535: the file is half the size of
+// 32-bit counts, with random access preserved
+void write_binary_index(std::ostream& out, uint64_t data_offset, uint n_files, const sam_hdr_t *header, const OutputState& state);
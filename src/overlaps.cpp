@@ -0,0 +1,129 @@
+#include <algorithm>
+#include "count_kernel.h"
+#include "nucleotides.h"
+#include "overlaps.h"
+#include "pileup.h"
+
+// Value of mate_bases at positions where the first mate has no base (deletion, skipped region)
+#define NO_MATE_BASE 0xffff
+
+
+MateOverlaps::~MateOverlaps() {
+
+    this->clear();
+}
+
+
+void MateOverlaps::clear() {
+
+    for (auto& mate: this->mates) bam_destroy1(mate.second);
+    this->mates.clear();
+    this->purge_size = OVERLAPS_MIN_PURGE_SIZE;
+}
+
+
+void MateOverlaps::purge(hts_pos_t position) {
+
+    for (auto it = this->mates.begin(); it != this->mates.end(); ) {
+        if (it->second->core.mpos < position) {
+            bam_destroy1(it->second);
+            it = this->mates.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    this->purge_size = std::max(static_cast<size_t>(OVERLAPS_MIN_PURGE_SIZE), 2 * this->mates.size());
+}
+
+
+void MateOverlaps::count(const bam1_t *b, DepthMatrix& depths, uint file_n, const UnitRange *ranges, size_t n_ranges, uint8_t min_base_quality) {
+
+    // Only primary alignments with a mate mapped on the same contig can overlap their mate
+    if ((b->core.flag & (BAM_FPAIRED | BAM_FMUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) != BAM_FPAIRED || b->core.mtid != b->core.tid) {
+        for (size_t k = 0; k < n_ranges; ++k) count_alignment(b, depths, file_n, ranges[k].start, ranges[k].end, min_base_quality, ranges[k].row - ranges[k].start);
+        return;
+    }
+
+    if (this->mates.size() >= this->purge_size) this->purge(b->core.pos);
+
+    // Second mate: its mate starts before (or at the same position) and is waiting
+    if (b->core.mpos <= b->core.pos && !this->mates.empty()) {
+        auto it = this->mates.find(bam_get_qname(b));
+        if (it != this->mates.end()) {
+            this->load_mate_bases(b, it->second);
+            for (size_t k = 0; k < n_ranges; ++k) this->count_second(b, depths, file_n, ranges[k], min_base_quality);
+            bam_destroy1(it->second);
+            this->mates.erase(it);
+            return;
+        }
+    }
+
+    // First mate: its mate starts inside its span, so it is kept until the mate arrives
+    if (b->core.mpos >= b->core.pos && b->core.mpos < bam_endpos(b)) {
+        std::string qname(bam_get_qname(b));
+        if (this->mates.find(qname) == this->mates.end()) this->mates.emplace(std::move(qname), bam_dup1(b));
+    }
+
+    for (size_t k = 0; k < n_ranges; ++k) count_alignment(b, depths, file_n, ranges[k].start, ranges[k].end, min_base_quality, ranges[k].row - ranges[k].start);
+}
+
+
+void MateOverlaps::load_mate_bases(const bam1_t *b, const bam1_t *mate) {
+
+    this->overlap_start = static_cast<uint32_t>(b->core.pos);
+    this->overlap_end = static_cast<uint32_t>(std::max(bam_endpos(mate), b->core.pos));  // The overlap is [overlap_start, overlap_end)
+
+    // Bases of the first mate in the overlap
+    this->mate_bases.assign(this->overlap_end - this->overlap_start, NO_MATE_BASE);
+    const uint8_t *sequence = bam_get_seq(mate);
+    const uint8_t *quality = bam_get_qual(mate);
+    const uint32_t *cigar = bam_get_cigar(mate);
+    uint32_t mapping_position = static_cast<uint32_t>(mate->core.pos), query_position = 0;
+    for (uint k = 0; k < mate->core.n_cigar; ++k) {
+        uint l = bam_cigar_oplen(cigar[k]);
+        int type = bam_cigar_type(bam_cigar_op(cigar[k]));
+        if (type == 3) {
+            for (uint32_t j = std::max(mapping_position, this->overlap_start); j < std::min(mapping_position + l, this->overlap_end); ++j) {
+                uint32_t q = query_position + j - mapping_position;
+                this->mate_bases[j - this->overlap_start] = static_cast<uint16_t>(NT16_COLUMN[bam_seqi(sequence, q)] | (quality[q] << 8));
+            }
+        }
+        if (type & 1) query_position += l;
+        if (type & 2) mapping_position += l;
+    }
+}
+
+
+void MateOverlaps::count_second(const bam1_t *b, DepthMatrix& depths, uint file_n, const UnitRange& range, uint8_t min_base_quality) {
+
+    // Bases of the second mate: in the overlap, the base with the highest quality is kept (the first mate's base on ties),
+    // after the overlap, bases are counted with the kernel
+    const uint8_t *sequence = bam_get_seq(b);
+    const uint8_t *quality = bam_get_qual(b);
+    const uint32_t *cigar = bam_get_cigar(b);
+    uint32_t offset = range.row - range.start;  // Added to positions to get matrix positions
+    uint32_t mapping_position = this->overlap_start, query_position = 0;
+    for (uint k = 0; k < b->core.n_cigar; ++k) {
+        uint l = bam_cigar_oplen(cigar[k]);
+        int type = bam_cigar_type(bam_cigar_op(cigar[k]));
+        if (type == 3) {
+            uint32_t first = std::max(mapping_position, range.start), last = std::min(mapping_position + l, range.end);  // Only count bases aligned in the range
+            uint32_t j = first;
+            for (; j < std::min(last, this->overlap_end); ++j) {
+                uint32_t q = query_position + j - mapping_position;
+                uint16_t mate_base = this->mate_bases[j - this->overlap_start];
+                uint8_t mate_quality = static_cast<uint8_t>(mate_base >> 8);
+                if (mate_base == NO_MATE_BASE) {
+                    if (quality[q] >= min_base_quality) depths.increment(j + offset, file_n, NT16_COLUMN[bam_seqi(sequence, q)]);
+                } else if (quality[q] > mate_quality) {
+                    if (mate_quality >= min_base_quality) depths.decrement(j + offset, file_n, mate_base & 0xff);  // The first mate's base was counted
+                    if (quality[q] >= min_base_quality) depths.increment(j + offset, file_n, NT16_COLUMN[bam_seqi(sequence, q)]);
+                }
+            }
+            if (j < last) count_run(depths, file_n, j + offset, sequence, quality, min_base_quality, query_position + j - mapping_position, last - j);
+        }
+        if (type & 1) query_position += l;
+        if (type & 2) mapping_position += l;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "htslib/htslib/sam.h"
+#include "depth_matrix.h"
+#include "units.h"
+
+// Number of mates waiting for their overlapping mate above which mates that can no longer be matched are removed
+#define OVERLAPS_MIN_PURGE_SIZE 1024
+
+
+// Counts alignments of one file so that positions covered by both mates of a pair are counted once, with the base of higher quality.
+// Alignments must be given in position order. The first mate of a pair whose mate starts inside its span is counted normally and kept
+// (keyed by read name) until its mate arrives; bases of the second mate in the overlap then replace the first mate's base only if their
+// quality is higher. Alignments that cannot overlap their mate are counted directly with count_alignment
+class MateOverlaps {
+
+    public:
+
+        MateOverlaps() {}
+        ~MateOverlaps();
+
+        MateOverlaps(const MateOverlaps&) = delete;
+        MateOverlaps& operator=(const MateOverlaps&) = delete;
+
+        // Count the bases of an alignment aligned in [start, end) with a quality of at least <min_base_quality>, resolving overlaps with its mate
+        void count(const bam1_t *b, DepthMatrix& depths, uint file_n, uint32_t start, uint32_t end, uint8_t min_base_quality) {
+            UnitRange range = {b->core.tid, start, end, start, start, end};
+            this->count(b, depths, file_n, &range, 1, min_base_quality);
+        }
+
+        // Same as above for the bases aligned in <n_ranges> sorted ranges, each stored at its own matrix positions (see UnitRange)
+        void count(const bam1_t *b, DepthMatrix& depths, uint file_n, const UnitRange *ranges, size_t n_ranges, uint8_t min_base_quality);
+
+        // Forget all waiting mates (before counting another range)
+        void clear();
+
+    private:
+
+        // Count the second mate of a pair in <range>, whose first mate was already counted and loaded with load_mate_bases()
+        void count_second(const bam1_t *b, DepthMatrix& depths, uint file_n, const UnitRange& range, uint8_t min_base_quality);
+
+        // Store the bases of the first mate <mate> in the overlap with the second mate <b> in mate_bases
+        void load_mate_bases(const bam1_t *b, const bam1_t *mate);
+
+        // Remove waiting mates whose mate starts before <position>: since alignments are sorted, these mates will never be matched
+        void purge(hts_pos_t position);
+
+        std::unordered_map<std::string, bam1_t*> mates;  // First mates waiting for their mate, {read name: copy of the alignment}
+        size_t purge_size = OVERLAPS_MIN_PURGE_SIZE;  // Number of waiting mates triggering the next purge
+        std::vector<uint16_t> mate_bases;  // Column (low 8 bits) and quality (high 8 bits) of the first mate's base at each position of an overlap
+        uint32_t overlap_start = 0, overlap_end = 0;  // Positions of the overlap held in mate_bases: [overlap_start, overlap_end)
+};
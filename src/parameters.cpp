@@ -0,0 +1,332 @@
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include "checkpoint.h"
+#include "parameters.h"
+
+
+void print_usage() {
+
+    std::cerr << "Usage: test [options] reference.fa in.<sam|bam|cram> [in2.<sam|bam|cram> ...]\n"
+              << "\n"
+              << "Options:\n"
+              << "  -s, --stream                Count positions in a sliding window instead of whole contigs (memory does not depend on contig length)\n"
+              << "  -S, --sequential            Read each input once from start to end without an index and merge them by position, counting in a\n"
+              << "                              sliding window. Inputs can be unindexed files, pipes or - (stdin), sorted by coordinate with\n"
+              << "                              contigs in the same order\n"
+              << "  -W, --whole-file            Read each input once from start to end without an index, counting contigs one after the other\n"
+              << "                              instead of querying the index for each contig (faster with many small contigs). Inputs can be\n"
+              << "                              unindexed files, pipes or - (stdin), sorted by coordinate with contigs in the same order\n"
+              << "  -t, --threads <int>         Number of threads counting input files concurrently, for each worker (default: 1)\n"
+              << "  -w, --workers <int>         Number of contigs processed concurrently, largest first; output stays in header order (default: 1)\n"
+              << "  -c, --chunk-size <int>      Split contigs longer than this size into chunks processed independently, with boundaries\n"
+              << "                              aligned on the alignment index (default: 0, no splitting). With -R, number of targeted\n"
+              << "                              positions in each unit (default: 1048576)\n"
+              << "  -B, --batch-size <int>      Pack consecutive contigs shorter than this size into units of about this many positions, each\n"
+              << "                              file being read once per unit with a multi-region iterator (default: 1048576, 0: no batching;\n"
+              << "                              not used with -s and -W)\n"
+              << "  -R, --regions <bed>         Only count positions in the regions of this BED file, each output as a region\n"
+              << "                              \"<contig>:<start>-<end>\" (1-based, inclusive) or \"<contig>\" if it covers the whole contig\n"
+              << "  -d, --decode-threads <int>  Number of threads decompressing BAM/CRAM data, shared by all input files (default: 0)\n"
+              << "  -p, --pipeline              Decode, count, format and write in separate stages running concurrently, with queue\n"
+              << "                              occupancy reported on stderr (default chunk size: 1048576)\n"
+              << "  -A, --readahead             Ask the kernel to load the BAM data of upcoming units while the current ones are processed, staying\n"
+              << "                              ahead by an amount adapted to the measured storage latency (for network filesystems)\n"
+              << "  -f, --require-flags <int>   Only count alignments with all these flags set (decimal or 0x hexadecimal, default: 0)\n"
+              << "  -F, --exclude-flags <int>   Do not count alignments with any of these flags set, e.g. 0xf04 for unmapped, secondary,\n"
+              << "                              QC-fail, duplicate and supplementary alignments (decimal or 0x hexadecimal, default: 0)\n"
+              << "  -q, --min-mapq <int>        Only count alignments with at least this mapping quality (default: 0)\n"
+              << "  -P, --proper-pair           Only count alignments in a proper pair\n"
+              << "  -l, --min-length <int>      Only count alignments covering at least this number of reference positions (default: 0)\n"
+              << "  -Q, --min-bq <int>          Only count bases with at least this base quality (default: 0)\n"
+              << "  -D, --dedup-overlaps        Count positions covered by both overlapping mates of a pair once, with the base of higher quality\n"
+              << "  -b, --binary                Output fixed-width little-endian counts with a header and a contig offset index instead of text\n"
+              << "                              (format described in output.h)\n"
+              << "  -V, --variant-sites         Only output variable positions, each line starting with its 0-based position in the contig\n"
+              << "  -a, --min-allele <int>      With -V, minimum count of a nucleotide over all files to be an allele; variable positions have\n"
+              << "                              at least two alleles among A, T, C, G (default: 1)\n"
+              << "  -m, --min-depth <int>       With -V, minimum total depth over all files of a variable position (default: 0)\n"
+              << "  -r, --rle                   Output runs of positions with identical counts as one line starting with the run length\n"
+              << "  -o, --output <file>         Write the output to this file instead of stdout\n"
+              << "  -z, --bgzf                  Compress the output with BGZF, using the decompression thread pool (-d) for compression. With -o,\n"
+              << "                              also write a block index (<file>.gzi) and, for text output, a position index (<file>.pidx,\n"
+              << "                              format described in output.h)\n"
+              << "  -k, --checkpoint            Record completed contigs (units) in a checkpoint next to the output file (<file>.ckpt, with -o),\n"
+              << "                              at most every " << CHECKPOINT_INTERVAL << " s, with fingerprints of the inputs\n"
+              << "  -K, --resume                Continue an interrupted run with the same inputs and options from its checkpoint, appending to\n"
+              << "                              the output file (or start from the beginning if there is no checkpoint); implies -k\n"
+              << "  -h, --help                  Print this message\n";
+}
+
+
+// Parse a positive integer option value. Returns 1 if the value is not a valid integer
+static int parse_uint(const char *value, uint& result) {
+
+    char *end = nullptr;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || value[0] == '-' || parsed > UINT32_MAX) return 1;
+    result = static_cast<uint>(parsed);
+
+    return 0;
+}
+
+
+// Parse a flags option value, in decimal or hexadecimal with a 0x prefix. Returns 1 if the value is not a valid 16-bit flag set
+static int parse_flags(const char *value, uint16_t& result) {
+
+    char *end = nullptr;
+    unsigned long parsed = strtoul(value, &end, 0);
+    if (end == value || *end != '\0' || value[0] == '-' || parsed > UINT16_MAX) return 1;
+    result = static_cast<uint16_t>(parsed);
+
+    return 0;
+}
+
+
+int parse_args(int argc, char *argv[], Parameters& parameters) {
+
+    static const struct option long_options[] = {
+        {"stream", no_argument, nullptr, 's'},
+        {"sequential", no_argument, nullptr, 'S'},
+        {"whole-file", no_argument, nullptr, 'W'},
+        {"threads", required_argument, nullptr, 't'},
+        {"workers", required_argument, nullptr, 'w'},
+        {"chunk-size", required_argument, nullptr, 'c'},
+        {"batch-size", required_argument, nullptr, 'B'},
+        {"regions", required_argument, nullptr, 'R'},
+        {"decode-threads", required_argument, nullptr, 'd'},
+        {"pipeline", no_argument, nullptr, 'p'},
+        {"readahead", no_argument, nullptr, 'A'},
+        {"require-flags", required_argument, nullptr, 'f'},
+        {"exclude-flags", required_argument, nullptr, 'F'},
+        {"min-mapq", required_argument, nullptr, 'q'},
+        {"proper-pair", no_argument, nullptr, 'P'},
+        {"min-length", required_argument, nullptr, 'l'},
+        {"min-bq", required_argument, nullptr, 'Q'},
+        {"dedup-overlaps", no_argument, nullptr, 'D'},
+        {"binary", no_argument, nullptr, 'b'},
+        {"variant-sites", no_argument, nullptr, 'V'},
+        {"min-allele", required_argument, nullptr, 'a'},
+        {"min-depth", required_argument, nullptr, 'm'},
+        {"rle", no_argument, nullptr, 'r'},
+        {"output", required_argument, nullptr, 'o'},
+        {"bgzf", no_argument, nullptr, 'z'},
+        {"checkpoint", no_argument, nullptr, 'k'},
+        {"resume", no_argument, nullptr, 'K'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int c;
+    uint value = 0;
+    bool proper_pair = false;
+    uint n_formats = 0;  // Number of output format options given
+    while ((c = getopt_long(argc, argv, "sSWt:w:c:B:R:d:pAf:F:q:Pl:Q:DbVa:m:ro:zkKh", long_options, nullptr)) != -1) {
+        switch (c) {
+            case 's':
+                parameters.stream = true;
+                break;
+            case 'S':
+                parameters.sequential = true;
+                break;
+            case 'W':
+                parameters.whole_file = true;
+                break;
+            case 't':
+                if (parse_uint(optarg, parameters.threads) != 0 || parameters.threads == 0) {
+                    std::cerr << "Error: invalid number of threads <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'w':
+                if (parse_uint(optarg, parameters.workers) != 0 || parameters.workers == 0) {
+                    std::cerr << "Error: invalid number of workers <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (parse_uint(optarg, parameters.chunk_size) != 0) {
+                    std::cerr << "Error: invalid chunk size <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'B':
+                if (parse_uint(optarg, parameters.batch_size) != 0) {
+                    std::cerr << "Error: invalid batch size <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'R':
+                parameters.regions = optarg;
+                break;
+            case 'd':
+                if (parse_uint(optarg, parameters.decode_threads) != 0) {
+                    std::cerr << "Error: invalid number of decompression threads <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'p':
+                parameters.pipeline = true;
+                break;
+            case 'A':
+                parameters.prefetch = true;
+                break;
+            case 'f':
+                if (parse_flags(optarg, parameters.filter.required_flags) != 0) {
+                    std::cerr << "Error: invalid required flags <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'F':
+                if (parse_flags(optarg, parameters.filter.excluded_flags) != 0) {
+                    std::cerr << "Error: invalid excluded flags <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'q':
+                if (parse_uint(optarg, value) != 0 || value > UINT8_MAX) {
+                    std::cerr << "Error: invalid minimum mapping quality <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                parameters.filter.min_mapq = static_cast<uint8_t>(value);
+                break;
+            case 'P':
+                proper_pair = true;
+                break;
+            case 'l':
+                if (parse_uint(optarg, parameters.filter.min_length) != 0) {
+                    std::cerr << "Error: invalid minimum aligned length <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'Q':
+                if (parse_uint(optarg, value) != 0 || value > UINT8_MAX) {
+                    std::cerr << "Error: invalid minimum base quality <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                parameters.filter.min_base_quality = static_cast<uint8_t>(value);
+                break;
+            case 'D':
+                parameters.filter.dedup_overlaps = true;
+                break;
+            case 'b':
+                parameters.output_options.format = OUTPUT_BINARY;
+                ++n_formats;
+                break;
+            case 'V':
+                parameters.output_options.format = OUTPUT_VARIANTS;
+                ++n_formats;
+                break;
+            case 'a':
+                if (parse_uint(optarg, parameters.output_options.min_allele_count) != 0 || parameters.output_options.min_allele_count == 0) {
+                    std::cerr << "Error: invalid minimum allele count <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (parse_uint(optarg, parameters.output_options.min_depth) != 0) {
+                    std::cerr << "Error: invalid minimum depth <" << optarg << ">" << std::endl;
+                    return 1;
+                }
+                break;
+            case 'r':
+                parameters.output_options.format = OUTPUT_RLE;
+                ++n_formats;
+                break;
+            case 'o':
+                parameters.output = optarg;
+                break;
+            case 'z':
+                parameters.bgzf = true;
+                break;
+            case 'k':
+                parameters.checkpoint = true;
+                break;
+            case 'K':
+                parameters.checkpoint = true;
+                parameters.resume = true;
+                break;
+            case 'h':
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    if (proper_pair) parameters.filter.required_flags |= BAM_FPROPER_PAIR;  // Applied after parsing so that -f does not overwrite it
+
+    // Positional arguments: reference followed by at least one alignment file
+    if (argc - optind < 2) {
+        print_usage();
+        return 1;
+    }
+
+    if (n_formats > 1) {
+        std::cerr << "Error: only one of --binary, --variant-sites and --rle can be used" << std::endl;
+        return 1;
+    }
+
+    // In stream mode, the output of a contig is written while it is counted: it cannot be held in the reorder buffer used by workers
+    if (parameters.stream && parameters.workers > 1) {
+        std::cerr << "Error: --stream cannot be used with more than one worker" << std::endl;
+        return 1;
+    }
+
+    // The pipeline has its own reading and counting threads and orders units itself
+    if (parameters.pipeline && (parameters.stream || parameters.workers > 1)) {
+        std::cerr << "Error: --pipeline cannot be used with --stream or with more than one worker" << std::endl;
+        return 1;
+    }
+
+    // Region units hold ranges of several contigs: they are neither streamed in contig order nor written as whole contig blocks
+    if (!parameters.regions.empty() && (parameters.stream || parameters.pipeline || parameters.output_options.format == OUTPUT_BINARY)) {
+        std::cerr << "Error: --regions cannot be used with --stream, --pipeline or --binary" << std::endl;
+        return 1;
+    }
+
+    // Sequential reading goes through whole files once, in contig order: units, regions and workers all need random access
+    if (parameters.sequential && (parameters.stream || parameters.pipeline || parameters.workers > 1 || parameters.chunk_size > 0 || !parameters.regions.empty())) {
+        std::cerr << "Error: --sequential cannot be used with --stream, --pipeline, --chunk-size, --regions or with more than one worker" << std::endl;
+        return 1;
+    }
+
+    // Whole-file reading counts complete contigs in header order: chunks, regions and workers need random access
+    if (parameters.whole_file && (parameters.stream || parameters.sequential || parameters.pipeline || parameters.workers > 1 || parameters.chunk_size > 0
+                                  || !parameters.regions.empty())) {
+        std::cerr << "Error: --whole-file cannot be used with --stream, --sequential, --pipeline, --chunk-size, --regions or with more than one worker" << std::endl;
+        return 1;
+    }
+
+    // Readahead follows the units of the default mode; files read sequentially already benefit from the kernel readahead
+    if (parameters.prefetch && (parameters.sequential || parameters.whole_file || parameters.pipeline)) {
+        std::cerr << "Error: --readahead cannot be used with --sequential, --whole-file or --pipeline" << std::endl;
+        return 1;
+    }
+
+    // Checkpoints record the size of a plain output file after each completed unit, which is truncated to it on resume: BGZF blocks and the
+    // binary index do not end at unit boundaries, and the sequential modes and the pipeline do not complete units in a resumable order
+    if (parameters.checkpoint && (parameters.output.empty() || parameters.output == "-" || parameters.bgzf || parameters.output_options.format == OUTPUT_BINARY
+                                  || parameters.sequential || parameters.whole_file || parameters.pipeline)) {
+        std::cerr << "Error: --checkpoint and --resume require --output to a file and cannot be used with --bgzf, --binary, --sequential, --whole-file or --pipeline" << std::endl;
+        return 1;
+    }
+
+    parameters.reference = argv[optind];
+    for (int i=optind + 1; i<argc; ++i) parameters.alignment_files.push_back(argv[i]);
+
+    // Without an index, files are opened once; stdin can only provide one of them
+    uint n_stdin = 0;
+    for (auto file: parameters.alignment_files) n_stdin += (strcmp(file, "-") == 0);
+    if (n_stdin > 0 && !parameters.sequential && !parameters.whole_file) {
+        std::cerr << "Error: reading an alignment file from stdin requires --sequential or --whole-file" << std::endl;
+        return 1;
+    }
+    if (n_stdin > 1) {
+        std::cerr << "Error: only one alignment file can be read from stdin" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "filter.h"
+#include "output.h"
+#include "units.h"
+
+
+// Simple structure holding all the run parameters given on the command line
+struct Parameters {
+    std::string reference;  // Path to the reference fasta file (required for CRAM inputs)
+    std::vector<char*> alignment_files;  // Paths to the alignment files, in output order
+    bool stream = false;  // Count positions in a sliding window and output them as soon as all files have passed them
+    bool sequential = false;  // Read whole files once without an index, merging them by position, and count them as in stream mode
+    bool whole_file = false;  // Read whole files once without an index, counting whole contigs in header order
+    uint threads = 1;  // Number of threads counting input files concurrently, for each worker
+    uint workers = 1;  // Number of contigs (or chunks) processed concurrently
+    uint decode_threads = 0;  // Number of threads in the pool decompressing input files, shared by all files (0: decompress on the reading thread)
+    uint chunk_size = 0;  // Split contigs longer than this size into chunks processed independently (0: no splitting)
+    uint batch_size = BATCH_SIZE;  // Pack consecutive contigs shorter than this size into units of about this many positions (0: no batching)
+    std::string regions;  // Path to a BED file of target regions (empty: count whole contigs)
+    ReadFilter filter;  // Alignments rejected by this filter are not counted
+    OutputOptions output_options;  // Format of the depths output
+    bool pipeline = false;  // Decode, count, format and write in separate pipelined stages connected by bounded queues
+    bool prefetch = false;  // Read the data of upcoming units ahead in the page cache
+    std::string output;  // Path to the output file (empty: stdout)
+    bool bgzf = false;  // Compress the output with BGZF and write block and position indexes next to the output file
+    bool checkpoint = false;  // Record completed units in a checkpoint next to the output file
+    bool resume = false;  // Continue an interrupted run from its checkpoint (implies checkpoint)
+};
+
+
+// Print usage information to stderr
+void print_usage();
+
+// Parse command-line arguments into a Parameters object. Returns 1 if the arguments are invalid
+int parse_args(int argc, char *argv[], Parameters& parameters);
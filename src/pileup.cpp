@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <iostream>
+#include <algorithm>
+#include "count_kernel.h"
+#include "overlaps.h"
+#include "pileup.h"
+
+
+void count_alignment(const bam1_t *b, DepthMatrix& depths, uint file_n, uint32_t start, uint32_t end, uint8_t min_base_quality, uint32_t offset) {
+
+    uint32_t mapping_position = static_cast<uint32_t>(b->core.pos);  // Current position in the reference
+    uint32_t query_position = 0;  // Current position in the read sequence
+    const uint8_t *sequence = bam_get_seq(b);
+    const uint8_t *quality = bam_get_qual(b);
+    const uint32_t *cigar = bam_get_cigar(b);
+
+    for (uint k = 0; k < b->core.n_cigar; ++k) {
+        uint op = bam_cigar_op(cigar[k]);
+        uint l = bam_cigar_oplen(cigar[k]);
+        int type = bam_cigar_type(op);  // Bit 1: operation consumes the query, bit 2: operation consumes the reference
+        if (type == 3) {  // Aligned bases (M, =, X)
+            uint32_t first = std::max(mapping_position, start), last = std::min(mapping_position + l, end);  // Only count bases aligned in [start, end)
+            if (first < last) count_run(depths, file_n, first + offset, sequence, quality, min_base_quality, query_position + first - mapping_position, last - first);
+        }
+        if (type & 1) query_position += l;  // Insertions and soft clips only consume the query
+        if (type & 2) mapping_position += l;  // Deletions and skipped regions only consume the reference
+    }
+}
+
+
+int process_file(inputFile* input, char *contig, uint32_t start, uint32_t end, DepthMatrix& depths, const ReadFilter& filter) {
+
+    hts_itr_t *iter = nullptr;
+    bam1_t *b = nullptr;
+    int result;
+    int tid = sam_hdr_name2tid(input->header, contig);  // Contig ids can differ between files, contigs are matched by name
+    MateOverlaps overlaps;  // Mates waiting for their overlapping mate, only used with filter.dedup_overlaps
+
+    // sam_itr_queryi returns an iterator over all alignments overlapping [start, end) on contig <tid>
+    if (tid < 0 || (iter = sam_itr_queryi(input->idx, tid, start, end)) == nullptr) {
+        std::cerr << "Region <" << contig << ":" << start + 1 << "-" << end << "> not found in index file";
+        return 1;
+    }
+
+    b = bam_init1();
+
+    // Iterate through all alignments in the specified region
+    while ((result = sam_itr_next(input->sam, iter, b)) >= 0) {
+        if (!filter.accept(b, input->filter_stats)) continue;  // Skip rejected reads before their CIGAR and sequence are read
+        // Alignments overlapping the range boundaries are only counted inside the range
+        if (filter.dedup_overlaps) {
+            overlaps.count(b, depths, input->file_n, start, end, filter.min_base_quality);
+        } else {
+            count_alignment(b, depths, input->file_n, start, end, filter.min_base_quality);
+        }
+    }
+
+    // Destroy objects
+    hts_itr_destroy(iter);
+    bam_destroy1(b);
+
+    if (result < -1) {
+        std::cerr << "Error processing region <" << contig << ":" << start + 1 << "-" << end << "> in file <" << input->sam->fn << "> due to truncated file or corrupt BAM index file";
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int process_sequential(SequentialReader& reader, int tid, uint32_t end, DepthMatrix& depths, const ReadFilter& filter) {
+
+    MateOverlaps overlaps;  // Mates waiting for their overlapping mate, only used with filter.dedup_overlaps
+
+    // The reader is at the first alignment of the contig, or at the first alignment of a following contig if this one has none
+    while (reader.on_contig(tid)) {
+        if (filter.dedup_overlaps) {
+            overlaps.count(reader.b, depths, reader.input->file_n, 0, end, filter.min_base_quality);
+        } else {
+            count_alignment(reader.b, depths, reader.input->file_n, 0, end, filter.min_base_quality);
+        }
+        reader.next(filter);
+    }
+
+    if (reader.result == SEQUENTIAL_UNSORTED) return 1;
+    if (reader.result < -1) {
+        std::cerr << "Error reading alignment file <" << reader.input->sam->fn << "> due to truncated file" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Ranges of a contig in a unit made of several ranges
+struct ContigRanges {
+    int tid;  // Contig id in the input file
+    size_t first, last;  // Ranges of the contig: [first, last)
+};
+
+
+// Count the alignments returned by <iter> in the ranges of <contigs>, then destroy <iter>. Returns the last sam_itr_next result
+static int count_ranges(inputFile* input, hts_itr_t *iter, const std::vector<UnitRange>& ranges, const std::vector<ContigRanges>& contigs, DepthMatrix& depths, const ReadFilter& filter) {
+
+    bam1_t *b = bam_init1();
+    MateOverlaps overlaps;  // Mates waiting for their overlapping mate, only used with filter.dedup_overlaps
+    int result;
+    int tid = -1;  // Contig of the previous alignment
+    size_t next = 0, last = 0;  // Ranges of the contig that can overlap the current alignment and the following ones: [next, last)
+
+    while ((result = sam_itr_next(input->sam, iter, b)) >= 0) {
+        if (!filter.accept(b, input->filter_stats)) continue;
+        if (b->core.tid != tid) {
+            tid = b->core.tid;
+            next = last = 0;
+            for (auto& contig: contigs) {
+                if (contig.tid == tid) {
+                    next = contig.first;
+                    last = contig.last;
+                }
+            }
+            overlaps.clear();
+        }
+        while (next < last && ranges[next].end <= b->core.pos) ++next;  // Alignments are sorted, so ranges ending before this one are complete
+        size_t end = next;
+        hts_pos_t alignment_end = bam_endpos(b);
+        while (end < last && ranges[end].start < alignment_end) ++end;
+        if (filter.dedup_overlaps) {
+            overlaps.count(b, depths, input->file_n, ranges.data() + next, end - next, filter.min_base_quality);
+        } else {
+            for (size_t k=next; k<end; ++k) count_alignment(b, depths, input->file_n, ranges[k].start, ranges[k].end, filter.min_base_quality, ranges[k].row - ranges[k].start);
+        }
+    }
+
+    hts_itr_destroy(iter);
+    bam_destroy1(b);
+
+    return result;
+}
+
+
+int process_ranges(inputFile* input, const std::vector<UnitRange>& ranges, sam_hdr_t *header, DepthMatrix& depths, const ReadFilter& filter) {
+
+    // Ranges of each contig are consecutive; contigs missing from this file have no alignments to count
+    std::vector<ContigRanges> contigs;
+    for (size_t i=0; i<ranges.size(); ++i) {
+        if (i == 0 || ranges[i].tid != ranges[i - 1].tid) contigs.push_back({sam_hdr_name2tid(input->header, header->target_name[ranges[i].tid]), i, i});
+        contigs.back().last = i + 1;
+    }
+    contigs.erase(std::remove_if(contigs.begin(), contigs.end(), [](const ContigRanges& contig) { return contig.tid < 0; }), contigs.end());
+    if (contigs.empty()) return 0;
+
+    int result = -1;
+
+    if (input->sam->format.format == cram) {
+        // The multi-region iterator of htslib 1.10 can miss alignments at the end of CRAM intervals: each range is read with its own iterator
+        for (auto& contig: contigs) {
+            for (size_t k=contig.first; k<contig.last && result >= -1; ++k) {
+                hts_itr_t *iter = sam_itr_queryi(input->idx, contig.tid, ranges[k].start, ranges[k].end);
+                if (iter == nullptr) {
+                    std::cerr << "Error creating iterator for file <" << input->sam->fn << ">" << std::endl;
+                    return 1;
+                }
+                result = count_ranges(input, iter, ranges, {{contig.tid, k, k + 1}}, depths, filter);
+            }
+        }
+    } else {
+        // One region list entry per contig with all its ranges as intervals. The iterator takes ownership of the region list and frees it
+        hts_reglist_t *reglist = static_cast<hts_reglist_t*>(calloc(contigs.size(), sizeof(hts_reglist_t)));
+        if (reglist == nullptr) return 1;
+        for (size_t c=0; c<contigs.size(); ++c) {
+            hts_reglist_t& region = reglist[c];
+            region.reg = header->target_name[ranges[contigs[c].first].tid];  // Converted to the contig id of this file by the iterator
+            region.count = static_cast<uint32_t>(contigs[c].last - contigs[c].first);
+            region.intervals = static_cast<hts_pair_pos_t*>(malloc(region.count * sizeof(hts_pair_pos_t)));
+            if (region.intervals == nullptr) {
+                hts_reglist_free(reglist, static_cast<int>(contigs.size()));
+                return 1;
+            }
+            for (uint32_t k=0; k<region.count; ++k) region.intervals[k] = {ranges[contigs[c].first + k].start, ranges[contigs[c].first + k].end};
+            region.min_beg = region.intervals[0].beg;
+            region.max_end = region.intervals[region.count - 1].end;
+        }
+        hts_itr_t *iter = sam_itr_regions(input->idx, input->header, reglist, static_cast<uint>(contigs.size()));
+        if (iter == nullptr) {
+            std::cerr << "Error creating multi-region iterator for file <" << input->sam->fn << ">" << std::endl;
+            return 1;
+        }
+        result = count_ranges(input, iter, ranges, contigs, depths, filter);
+    }
+
+    if (result < -1) {
+        std::cerr << "Error processing regions in file <" << input->sam->fn << "> due to truncated file or corrupt index file" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "htslib/htslib/sam.h"
+#include "depth_matrix.h"
+#include "filter.h"
+#include "input.h"
+#include "sequential.h"
+#include "units.h"
+
+
+// Add the aligned bases of an alignment to the counters of file <file_n> in <depths>.
+// Only bases aligned in [start, end) with a base quality of at least <min_base_quality> are counted, so that an alignment overlapping several ranges
+// is counted exactly once per position. Bases aligned at position p are counted at position p + <offset> of <depths> (see UnitRange)
+void count_alignment(const bam1_t *b, DepthMatrix& depths, uint file_n, uint32_t start, uint32_t end, uint8_t min_base_quality=0, uint32_t offset=0);
+
+// Count all alignments overlapping positions [start, end) of a contig in an input file into <depths>, which holds this range
+// Alignments rejected by <filter> are not counted
+int process_file(inputFile* input, char *contig, uint32_t start, uint32_t end, DepthMatrix& depths, const ReadFilter& filter);
+
+// Count all alignments of contig <tid> (id in the header of the first input file) of length <end> from a file read sequentially into <depths>,
+// which holds the whole contig. The reader is left at the first alignment of the following contigs, so that contigs must be counted in order
+int process_sequential(SequentialReader& reader, int tid, uint32_t end, DepthMatrix& depths, const ReadFilter& filter);
+
+// Count all alignments overlapping the ranges of a unit made of several ranges into <depths>, which holds the ranges one after the other.
+// The file is read once for all ranges with a multi-region iterator; range contig ids are from <header>, contigs are matched by name.
+// Alignments rejected by <filter> are not counted
+int process_ranges(inputFile* input, const std::vector<UnitRange>& ranges, sam_hdr_t *header, DepthMatrix& depths, const ReadFilter& filter);
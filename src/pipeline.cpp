@@ -0,0 +1,312 @@
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "bounded_queue.h"
+#include "depth_matrix.h"
+#include "output.h"
+#include "overlaps.h"
+#include "pileup.h"
+#include "pipeline.h"
+
+
+// Batch of alignments read from one file for one unit
+struct RecordBatch {
+    std::vector<bam1_t*> records;  // Allocated once, reused for every batch
+    uint n_records = 0;  // Number of alignments in use in <records>
+    uint unit = 0;  // Unit the alignments were read for
+    bool end_of_unit = false;  // True for the last batch of a unit
+};
+
+
+// Depth matrix for one unit, filled by the counters of all files and then formatted
+struct Tile {
+    DepthMatrix depths;
+    uint unit = 0;  // Unit currently assigned to this tile, counters wait until it matches the unit of their batch
+    uint n_done = 0;  // Number of files fully counted for <unit>
+    Tile(uint n_files) : depths(n_files) {}
+};
+
+
+class Pipeline {
+
+    public:
+
+        Pipeline(std::vector<inputFile>& input, const std::vector<WorkUnit>& units, const ReadFilter& filter, const OutputOptions& options, std::ostream& out,
+                 OutputState& state);
+        ~Pipeline();
+
+        int run();
+
+    private:
+
+        void read(uint file_n);  // Reader stage for one file
+        void count(uint file_n);  // Counter stage for one file
+        void format();  // Formatter stage
+        void write();  // Writer stage
+        void fail();  // Stop all stages after an error
+        int prepare_tile(uint unit);  // Clear the tile for <unit> and let counters use it
+        void report();  // Print queue occupancy statistics to stderr
+
+        std::vector<inputFile>& input;
+        const std::vector<WorkUnit>& units;
+        const ReadFilter& filter;
+        const OutputOptions& options;
+        std::ostream& out;
+        OutputState& state;  // Only used by the formatter
+        uint n_files;
+
+        std::vector<std::unique_ptr<RecordBatch>> batches;  // All batches, owned by the pipeline
+        std::vector<std::unique_ptr<BoundedQueue<RecordBatch*>>> empty_batches;  // For each file, batches available to the reader
+        std::vector<std::unique_ptr<BoundedQueue<RecordBatch*>>> full_batches;  // For each file, batches waiting to be counted
+        BoundedQueue<uint> counted_units;  // Units fully counted, waiting to be formatted
+        BoundedQueue<std::string> buffers;  // Formatted output waiting to be written
+
+        std::vector<std::unique_ptr<Tile>> tiles;  // Unit u uses tile u % PIPELINE_TILES
+        std::mutex tiles_mutex;
+        std::condition_variable tile_ready;
+
+        std::atomic<bool> failed;
+};
+
+
+Pipeline::Pipeline(std::vector<inputFile>& input, const std::vector<WorkUnit>& units, const ReadFilter& filter, const OutputOptions& options, std::ostream& out,
+                   OutputState& state)
+    : input(input), units(units), filter(filter), options(options), out(out), state(state), counted_units(PIPELINE_TILES), buffers(PIPELINE_BUFFERS), failed(false) {
+
+    this->n_files = static_cast<uint>(input.size());
+
+    for (uint f=0; f<this->n_files; ++f) {
+        this->empty_batches.emplace_back(new BoundedQueue<RecordBatch*>(PIPELINE_BATCHES));
+        this->full_batches.emplace_back(new BoundedQueue<RecordBatch*>(PIPELINE_BATCHES));
+        for (uint i=0; i<PIPELINE_BATCHES; ++i) {
+            this->batches.emplace_back(new RecordBatch());
+            for (uint j=0; j<PIPELINE_BATCH_SIZE; ++j) this->batches.back()->records.push_back(bam_init1());
+            this->empty_batches[f]->push(this->batches.back().get());
+        }
+    }
+
+    for (uint i=0; i<PIPELINE_TILES; ++i) this->tiles.emplace_back(new Tile(this->n_files));
+}
+
+
+Pipeline::~Pipeline() {
+
+    for (auto& batch: this->batches) {
+        for (auto b: batch->records) bam_destroy1(b);
+    }
+}
+
+
+int Pipeline::run() {
+
+    // The first tiles are ready before any counter starts
+    for (uint u=0; u<PIPELINE_TILES && u<this->units.size(); ++u) {
+        if (this->prepare_tile(u) != 0) return 1;
+    }
+
+    std::vector<std::thread> threads;
+    for (uint f=0; f<this->n_files; ++f) {
+        threads.emplace_back(&Pipeline::read, this, f);
+        threads.emplace_back(&Pipeline::count, this, f);
+    }
+    threads.emplace_back(&Pipeline::format, this);
+    threads.emplace_back(&Pipeline::write, this);
+
+    for (auto& thread: threads) thread.join();
+
+    this->report();
+
+    return this->failed ? 1 : 0;
+}
+
+
+void Pipeline::fail() {
+
+    this->failed = true;
+
+    for (uint f=0; f<this->n_files; ++f) {
+        this->empty_batches[f]->close();
+        this->full_batches[f]->close();
+    }
+    this->counted_units.close();
+    this->buffers.close();
+
+    std::lock_guard<std::mutex> lock(this->tiles_mutex);
+    this->tile_ready.notify_all();
+}
+
+
+int Pipeline::prepare_tile(uint unit) {
+
+    Tile& tile = *this->tiles[unit % PIPELINE_TILES];
+
+    std::lock_guard<std::mutex> lock(this->tiles_mutex);
+    if (tile.depths.reset(this->units[unit].end - this->units[unit].start, this->units[unit].start) != 0) return 1;
+    tile.unit = unit;
+    tile.n_done = 0;
+    this->tile_ready.notify_all();
+
+    return 0;
+}
+
+
+void Pipeline::read(uint file_n) {
+
+    inputFile& file = this->input[file_n];
+    RecordBatch *batch = nullptr;
+
+    for (uint u=0; u<this->units.size(); ++u) {
+
+        const WorkUnit& unit = this->units[u];
+        char *contig = this->input[0].header->target_name[unit.tid];
+        int tid = sam_hdr_name2tid(file.header, contig);  // Contig ids can differ between files, contigs are matched by name
+        hts_itr_t *iter = nullptr;
+        int result = 0;
+
+        if (file_n == 0 && unit.start == 0) std::cerr << "Processing contig " << contig << " (" << this->input[0].header->target_len[unit.tid] << " bp)" << std::endl;
+
+        if (tid < 0 || (iter = sam_itr_queryi(file.idx, tid, unit.start, unit.end)) == nullptr) {
+            std::cerr << "Region <" << contig << ":" << unit.start + 1 << "-" << unit.end << "> not found in index file";
+            this->fail();
+            return;
+        }
+
+        // Fill batches until the iterator is exhausted; the last batch of the unit is flagged even if it is empty
+        bool end_of_unit = false;
+        while (!end_of_unit) {
+            if (!this->empty_batches[file_n]->pop(batch)) break;
+            batch->unit = u;
+            batch->n_records = 0;
+            while (batch->n_records < PIPELINE_BATCH_SIZE && (result = sam_itr_next(file.sam, iter, batch->records[batch->n_records])) >= 0) {
+                if (this->filter.accept(batch->records[batch->n_records], file.filter_stats)) ++batch->n_records;  // Rejected alignments are overwritten by the next one
+            }
+            end_of_unit = (result < 0);
+            batch->end_of_unit = end_of_unit;
+            if (result < -1) {
+                std::cerr << "Error processing region <" << contig << ":" << unit.start + 1 << "-" << unit.end << "> in file <" << file.sam->fn << "> due to truncated file or corrupt BAM index file";
+                this->fail();
+                break;
+            }
+            if (!this->full_batches[file_n]->push(batch)) break;
+        }
+
+        hts_itr_destroy(iter);
+        if (!end_of_unit || this->failed) return;
+    }
+
+    this->full_batches[file_n]->close();
+}
+
+
+void Pipeline::count(uint file_n) {
+
+    RecordBatch *batch = nullptr;
+    Tile *tile = nullptr;
+    uint tile_unit = 0;  // Unit of <tile>, kept locally since the tile is reassigned by the formatter
+    MateOverlaps overlaps;  // Mates waiting for their overlapping mate in the current unit, only used with filter.dedup_overlaps
+
+    while (this->full_batches[file_n]->pop(batch)) {
+
+        const WorkUnit& unit = this->units[batch->unit];
+
+        // Wait until the formatter has released the tile for this unit
+        if (tile == nullptr || tile_unit != batch->unit) {
+            tile = this->tiles[batch->unit % PIPELINE_TILES].get();
+            tile_unit = batch->unit;
+            std::unique_lock<std::mutex> lock(this->tiles_mutex);
+            this->tile_ready.wait(lock, [&]{ return tile->unit == batch->unit || this->failed; });
+            if (this->failed) return;
+        }
+
+        if (this->filter.dedup_overlaps) {
+            for (uint i=0; i<batch->n_records; ++i) overlaps.count(batch->records[i], tile->depths, file_n, unit.start, unit.end, this->filter.min_base_quality);
+            if (batch->end_of_unit) overlaps.clear();
+        } else {
+            for (uint i=0; i<batch->n_records; ++i) count_alignment(batch->records[i], tile->depths, file_n, unit.start, unit.end, this->filter.min_base_quality);
+        }
+
+        if (batch->end_of_unit) {
+            // The last file to complete a unit sends it to the formatter; units are completed in order since every file processes units in order
+            std::lock_guard<std::mutex> lock(this->tiles_mutex);
+            if (++tile->n_done == this->n_files && !this->counted_units.push(batch->unit)) return;
+        }
+
+        if (!this->empty_batches[file_n]->push(batch)) return;
+    }
+}
+
+
+void Pipeline::format() {
+
+    uint u = 0;
+    uint n_formatted = 0;
+
+    while (n_formatted < this->units.size() && this->counted_units.pop(u)) {
+
+        const WorkUnit& unit = this->units[u];
+        Tile& tile = *this->tiles[u % PIPELINE_TILES];
+
+        // Output depths for this unit in buffers of PIPELINE_FORMAT_ROWS positions
+        std::ostringstream buffer;
+        if (unit.start == 0) write_region_header(buffer, this->input[0].header->target_name[unit.tid], this->input[0].header->target_len[unit.tid], this->options.format, this->state);
+        for (uint32_t start=unit.start; start<unit.end; start+=PIPELINE_FORMAT_ROWS) {
+            write_rows(buffer, tile.depths, start, std::min(unit.end, start + PIPELINE_FORMAT_ROWS), this->options, this->state);
+            if (!this->buffers.push(buffer.str())) return;
+            buffer.str("");
+        }
+        if (unit.start == unit.end && !this->buffers.push(buffer.str())) return;
+
+        // The tile can be reused for the unit PIPELINE_TILES positions later
+        if (u + PIPELINE_TILES < this->units.size() && this->prepare_tile(u + PIPELINE_TILES) != 0) {
+            this->fail();
+            return;
+        }
+        ++n_formatted;
+    }
+
+    this->buffers.close();
+}
+
+
+void Pipeline::write() {
+
+    std::string buffer;
+
+    while (this->buffers.pop(buffer)) this->out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+
+void Pipeline::report() {
+
+    // Batches queues are summed over all files
+    QueueStats batch_stats;
+    for (uint f=0; f<this->n_files; ++f) {
+        QueueStats file_stats = this->full_batches[f]->get_stats();
+        batch_stats.capacity = file_stats.capacity;
+        batch_stats.n_pop += file_stats.n_pop;
+        batch_stats.total_occupancy += file_stats.total_occupancy;
+        batch_stats.full_waits += file_stats.full_waits;
+        batch_stats.empty_waits += file_stats.empty_waits;
+    }
+
+    auto print_stats = [](const char *name, const QueueStats& stats) {
+        double mean = (stats.n_pop > 0) ? static_cast<double>(stats.total_occupancy) / static_cast<double>(stats.n_pop) : 0;
+        std::cerr << "  " << name << ": mean occupancy " << mean << "/" << stats.capacity << ", producer waits " << stats.full_waits << ", consumer waits " << stats.empty_waits << std::endl;
+    };
+
+    std::cerr << "Pipeline queues (a queue often full means a slow consumer, often empty means a slow producer):" << std::endl;
+    print_stats("decoded batches (readers -> counters, per file)", batch_stats);
+    print_stats("counted tiles (counters -> formatter)", this->counted_units.get_stats());
+    print_stats("formatted buffers (formatter -> writer)", this->buffers.get_stats());
+}
+
+
+int run_pipeline(std::vector<inputFile>& input, const std::vector<WorkUnit>& units, const ReadFilter& filter, const OutputOptions& options, std::ostream& out,
+                 OutputState& state) {
+
+    Pipeline pipeline(input, units, filter, options, out, state);
+    return pipeline.run();
+}
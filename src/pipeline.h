@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "filter.h"
+#include "input.h"
+#include "output.h"
+#include "units.h"
+
+// Size of the depth tiles (work units) used by the pipeline when no chunk size is given
+#define PIPELINE_TILE_SIZE 1048576
+
+// Number of depth tiles in flight: one being counted, one being formatted, one ready in advance
+#define PIPELINE_TILES 3
+
+// Number of alignments in a batch sent from a reader to a counter
+#define PIPELINE_BATCH_SIZE 512
+
+// Number of batches in flight for each input file
+#define PIPELINE_BATCHES 8
+
+// Number of positions formatted in each output buffer sent to the writer
+#define PIPELINE_FORMAT_ROWS 16384
+
+// Number of formatted output buffers in flight
+#define PIPELINE_BUFFERS 8
+
+
+// Process all work units with a staged pipeline, each stage running on its own threads and connected to the next one by a bounded queue:
+// - readers (one per file) decode alignments for each unit in order and send the alignments accepted by <filter> in batches
+// - counters (one per file) count batches into the depth tile of the unit, in the file's own block of the tile
+// - a formatter converts completed tiles to text or binary output with <options>, in unit order, continuing the output <state>
+// - a writer writes formatted text to <out>
+// Full queues block the stage producing data (backpressure), so memory usage is bounded by the queue sizes and number of tiles.
+// Occupancy of each queue is reported on stderr at the end to identify the slowest stage
+int run_pipeline(std::vector<inputFile>& input, const std::vector<WorkUnit>& units, const ReadFilter& filter, const OutputOptions& options, std::ostream& out,
+                 OutputState& state);
@@ -0,0 +1,209 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <utility>
+#include "prefetch.h"
+
+
+// Current time in seconds
+static double now() {
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+Prefetcher::~Prefetcher() {
+
+    if (this->thread.joinable()) this->stop();
+}
+
+
+int Prefetcher::start(std::vector<inputFile>& input, const std::vector<WorkUnit>& units, const std::vector<uint>& order) {
+
+    this->units = &units;
+    this->order = order;
+    this->rank.resize(units.size());
+    for (uint i=0; i<order.size(); ++i) this->rank[order[i]] = i;
+    this->advised.assign(order.size(), 0);
+
+    // Contig ids and lengths are mapped here, before counting threads use the headers, so that the prefetching thread does not look up names
+    bool any_file = false;
+    for (auto& file: input) {
+        PrefetchFile prefetch_file = {-1, nullptr, {}, {}};
+        if (file.sam->format.format == bam && file.idx != nullptr && (prefetch_file.idx = sam_index_load(file.sam, file.sam->fn)) != nullptr
+            && (prefetch_file.fd = ::open(file.sam->fn, O_RDONLY)) >= 0) {
+            for (int tid=0; tid<input[0].header->n_targets; ++tid) prefetch_file.tids.push_back(sam_hdr_name2tid(file.header, input[0].header->target_name[tid]));
+            for (int tid=0; tid<file.header->n_targets; ++tid) prefetch_file.lengths.push_back(static_cast<uint32_t>(file.header->target_len[tid]));
+            any_file = true;
+        }
+        this->files.push_back(std::move(prefetch_file));
+    }
+    if (!any_file) return 0;
+
+    this->start_time = now();
+    this->running = true;
+    try {
+        this->thread = std::thread(&Prefetcher::run, this);
+    } catch (const std::system_error&) {
+        std::cerr << "Error starting prefetching thread" << std::endl;
+        this->running = false;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+void Prefetcher::started(uint unit) {
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->processed = std::max(this->processed, this->rank[unit] + 1);
+    }
+    this->wake.notify_one();
+}
+
+
+void Prefetcher::stop() {
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->running = false;
+    }
+    this->wake.notify_one();
+    if (this->thread.joinable()) {
+        this->thread.join();
+        uint64_t total = (this->next > 0) ? this->advised[this->next - 1] : 0;
+        std::cerr << "Prefetch: " << this->next << " units, " << total / 1048576 << " MB advised, probe latency " << this->latency * 1000
+                  << " ms, window up to " << this->max_ahead / 1048576 << " MB" << std::endl;
+    }
+    for (auto& file: this->files) {
+        if (file.fd >= 0) ::close(file.fd);
+        if (file.idx) hts_idx_destroy(file.idx);
+        file.fd = -1;
+        file.idx = nullptr;
+    }
+}
+
+
+void Prefetcher::run() {
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (this->running && this->next < this->order.size()) {
+        uint64_t done = (this->next > 0) ? this->advised[this->next - 1] : 0;  // Bytes advised so far
+        // Units already being processed are not worth prefetching anymore
+        if (this->next < this->processed) {
+            for (uint i=this->next; i<this->processed; ++i) this->advised[i] = done;
+            this->next = this->processed;
+            continue;
+        }
+        uint64_t consumed = (this->processed > 0) ? this->advised[this->processed - 1] : 0;  // Bytes advised for units already processed
+        if (done - consumed >= this->ahead) {
+            this->wake.wait(lock);
+            continue;
+        }
+
+        uint unit = this->order[this->next];
+        lock.unlock();
+        uint64_t bytes = this->prefetch_unit(unit);
+        lock.lock();
+        this->advised[this->next] = done + bytes;
+        ++this->next;
+        ++this->n_prefetched;
+
+        // Keep enough data requested to cover several latency periods at the rate processing consumes data. Units processed before they
+        // were prefetched (when the prefetcher falls behind, on slow storage) have no advised size: the rate is estimated from the number of
+        // units processed and the mean size of the prefetched units
+        double elapsed = now() - this->start_time;
+        if (this->processed > 0 && elapsed > 0) {
+            double unit_bytes = static_cast<double>(done + bytes) / this->n_prefetched;
+            double window = this->processed * unit_bytes / elapsed * this->latency * PREFETCH_LATENCY_PERIODS;
+            this->ahead = static_cast<uint64_t>(std::min(std::max(window, static_cast<double>(PREFETCH_MIN_AHEAD)), static_cast<double>(PREFETCH_MAX_AHEAD)));
+            this->max_ahead = std::max(this->max_ahead, this->ahead);
+        }
+    }
+}
+
+
+uint64_t Prefetcher::prefetch_unit(uint unit) {
+
+    const WorkUnit& work_unit = (*this->units)[unit];
+    std::vector<UnitRange> single_range;
+    if (work_unit.ranges.empty()) single_range.push_back({work_unit.tid, work_unit.start, work_unit.end, 0, work_unit.start, work_unit.end});
+    const std::vector<UnitRange>& ranges = work_unit.ranges.empty() ? single_range : work_unit.ranges;
+
+    uint64_t total = 0;
+    int probe_fd = -1;  // File and offset of the last block advised
+    uint64_t probe_offset = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> extents;  // Compressed byte ranges of the unit in a file: [begin, end)
+
+    for (auto& file: this->files) {
+        if (file.fd < 0) continue;
+        extents.clear();
+        // Contiguous ranges (consecutive whole contigs of a batch, or split regions) are stored contiguously in the file: only the first and
+        // last ranges of each group of contiguous ranges are queried, the data of the group being in between. Ranges are contiguous in this
+        // file if the next one starts where the previous one ends, or at the start of the next contig of this file when the previous one
+        // reaches the end of its contig
+        auto tid_of = [&](size_t k) { return file.tids[static_cast<size_t>(ranges[k].tid)]; };
+        auto contiguous = [&](size_t k) {
+            int tid = tid_of(k), next_tid = tid_of(k + 1);
+            if (tid < 0 || next_tid < 0) return false;
+            return (next_tid == tid && ranges[k + 1].start == ranges[k].end)
+                   || (next_tid == tid + 1 && ranges[k + 1].start == 0 && ranges[k].end == file.lengths[static_cast<size_t>(tid)]);
+        };
+        for (size_t first=0, last=0; first<ranges.size(); first=last+1) {
+            last = first;
+            while (last + 1 < ranges.size() && contiguous(last)) ++last;
+            uint64_t begin = UINT64_MAX, end = 0;
+            for (size_t k: {first, last}) {
+                int tid = tid_of(k);
+                hts_itr_t *iter = (tid >= 0) ? sam_itr_queryi(file.idx, tid, ranges[k].start, ranges[k].end) : nullptr;
+                if (iter == nullptr) continue;
+                for (int i=0; i<iter->n_off; ++i) {
+                    begin = std::min(begin, iter->off[i].u >> 16);
+                    end = std::max(end, (iter->off[i].v >> 16) + PREFETCH_BGZF_BLOCK_SIZE);
+                }
+                hts_itr_destroy(iter);
+            }
+            if (begin < end) extents.emplace_back(begin, end);
+        }
+        if (extents.empty()) continue;
+
+        // Ranges of consecutive contigs or regions share blocks: overlapping extents are merged into one request
+        std::sort(extents.begin(), extents.end());
+        uint64_t begin = extents[0].first, end = extents[0].second;
+        for (auto& extent: extents) {
+            if (extent.first > end) {
+                posix_fadvise(file.fd, static_cast<off_t>(begin), static_cast<off_t>(end - begin), POSIX_FADV_WILLNEED);
+                total += end - begin;
+                begin = extent.first;
+            }
+            end = std::max(end, extent.second);
+        }
+        posix_fadvise(file.fd, static_cast<off_t>(begin), static_cast<off_t>(end - begin), POSIX_FADV_WILLNEED);
+        total += end - begin;
+        probe_fd = file.fd;
+        probe_offset = end - PREFETCH_BGZF_BLOCK_SIZE;
+    }
+
+    // The last block advised for the unit is read once all its data is advised: it is not touched by the reader yet (the reader is before the
+    // unit), so the read waits for the advised data to arrive and measures the latency of the storage for prefetched data
+    if (probe_fd >= 0) this->probe(probe_fd, probe_offset);
+
+    return total;
+}
+
+
+void Prefetcher::probe(int fd, uint64_t offset) {
+
+    char buffer[PREFETCH_PROBE_SIZE];
+    double start = now();
+    if (pread(fd, buffer, PREFETCH_PROBE_SIZE, static_cast<off_t>(offset)) < 0) return;
+    double elapsed = now() - start;
+
+    this->latency = (this->n_probes == 0) ? elapsed : 0.8 * this->latency + 0.2 * elapsed;
+    ++this->n_probes;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "input.h"
+#include "units.h"
+
+// Bounds of the amount of compressed data advised ahead of the unit being processed, summed over all files (bytes)
+#define PREFETCH_MIN_AHEAD 4194304
+#define PREFETCH_MAX_AHEAD 536870912
+
+// Size of the synchronous read of the last block of each prefetched unit, timed to measure the latency of the storage (bytes)
+#define PREFETCH_PROBE_SIZE 4096
+
+// Number of latency periods of data kept ahead of processing: the window is <consumption rate> * <latency> * PREFETCH_LATENCY_PERIODS
+#define PREFETCH_LATENCY_PERIODS 8
+
+// Maximum size of a BGZF block, added to the offset of the last block of a range to cover the whole block
+#define PREFETCH_BGZF_BLOCK_SIZE 65536
+
+
+// Background readahead of the data of upcoming work units. Byte ranges of each unit are taken from the BAM index, and the kernel is asked to
+// load them into the page cache with posix_fadvise(POSIX_FADV_WILLNEED) while the current units are counted and written.
+// The prefetcher stays a window of bytes ahead of the unit being processed; the window adapts to the storage: the latency measured by a small
+// timed read of the last block advised for each unit (which waits for the advised data, not yet touched by the reader), times the rate at which
+// processing consumes data, gives the amount of data to request in advance.
+// Only BAM files are prefetched (CRAM and SAM indexes do not give byte ranges without seeking the file)
+class Prefetcher {
+
+    public:
+
+        Prefetcher() {}
+        ~Prefetcher();
+
+        Prefetcher(const Prefetcher&) = delete;
+        Prefetcher& operator=(const Prefetcher&) = delete;
+
+        // Start prefetching the data of <units> for the files of <input>, in <order> of unit numbers. Each file index is loaded again for the
+        // prefetching thread, since the index of <input> is used by its reader. Returns 1 if the prefetching thread could not be started
+        int start(std::vector<inputFile>& input, const std::vector<WorkUnit>& units, const std::vector<uint>& order);
+
+        // Report that processing of unit <unit> started, moving the window forward. Called from any worker
+        void started(uint unit);
+
+        // Stop the prefetching thread and print statistics to stderr
+        void stop();
+
+    private:
+
+        struct PrefetchFile {
+            int fd;  // Descriptor used for advice and latency probes (page cache is shared with the descriptor reading the file)
+            hts_idx_t *idx;  // Index of the file, only used by the prefetching thread
+            std::vector<int> tids;  // Contig id in this file for each contig id of the first input file (-1 if missing)
+            std::vector<uint32_t> lengths;  // Length of each contig of this file
+        };
+
+        void run();  // Prefetching thread
+        uint64_t prefetch_unit(uint unit);  // Advise the byte ranges of a unit in all files. Returns the number of bytes advised
+        void probe(int fd, uint64_t offset);  // Time a small read at <offset> and update the latency estimate
+
+        std::vector<PrefetchFile> files;
+        const std::vector<WorkUnit> *units = nullptr;
+        std::vector<uint> order;  // Unit numbers in processing order
+        std::vector<uint> rank;  // Position in <order> of each unit
+        std::vector<uint64_t> advised;  // Cumulative number of bytes advised up to each position of <order> (included)
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool running = false;
+        uint next = 0;  // Position in <order> of the next unit to prefetch
+        uint processed = 0;  // Position in <order> following the last unit whose processing started
+        double latency = 0;  // Moving average of the probe latency (seconds)
+        double start_time = 0;  // Time when prefetching started (seconds)
+        uint64_t ahead = PREFETCH_MIN_AHEAD;  // Current window (bytes)
+        uint64_t max_ahead = PREFETCH_MIN_AHEAD;  // Largest window used
+        uint n_probes = 0;
+        uint n_prefetched = 0;  // Number of units prefetched (units processed before being reached are skipped)
+};
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include "htslib/htslib/regidx.h"
+#include "regions.h"
+
+
+// Add the range [start, end) of contig <tid> to the units, starting a new unit when the current one reaches <unit_size> positions
+static void add_range(std::vector<WorkUnit>& units, int tid, uint32_t start, uint32_t end, uint32_t unit_size) {
+
+    for (uint32_t position = start; position < end; ) {
+        if (units.empty() || units.back().end >= unit_size) units.push_back({tid, 0, 0, {}});
+        WorkUnit& unit = units.back();
+        uint32_t length = std::min(end - position, unit_size - unit.end);
+        unit.ranges.push_back({tid, position, position + length, unit.end, start, end});
+        unit.end += length;
+        position += length;
+    }
+}
+
+
+int make_region_units(const char *path, sam_hdr_t *header, uint32_t unit_size, std::vector<WorkUnit>& units) {
+
+    regidx_t *idx = regidx_init(path, regidx_parse_bed, nullptr, 0, nullptr);
+    if (idx == nullptr) {
+        std::cerr << "Error reading regions file <" << path << ">" << std::endl;
+        return 1;
+    }
+
+    int n_contigs = 0;
+    char **contigs = regidx_seq_names(idx, &n_contigs);
+    for (int i=0; i<n_contigs; ++i) {
+        if (sam_hdr_name2tid(header, contigs[i]) < 0) std::cerr << "Warning: contig <" << contigs[i] << "> from regions file is not in the alignment files, its regions are ignored" << std::endl;
+    }
+
+    // Regions of each contig in header order, sorted and merged
+    regitr_t *itr = regitr_init(idx);
+    std::vector<std::pair<uint32_t, uint32_t>> regions;
+    for (int tid=0; tid<header->n_targets; ++tid) {
+        uint32_t contig_len = header->target_len[tid];
+        regions.clear();
+        if (contig_len == 0 || !regidx_overlap(idx, header->target_name[tid], 0, contig_len - 1, itr)) continue;
+        while (regitr_overlap(itr)) regions.emplace_back(static_cast<uint32_t>(itr->beg), static_cast<uint32_t>(std::min(itr->end + 1, static_cast<hts_pos_t>(contig_len))));
+        std::sort(regions.begin(), regions.end());
+        uint32_t start = regions[0].first, end = regions[0].second;
+        for (auto& region: regions) {
+            if (region.first > end) {
+                add_range(units, tid, start, end, unit_size);
+                start = region.first;
+            }
+            end = std::max(end, region.second);
+        }
+        add_range(units, tid, start, end, unit_size);
+    }
+
+    regitr_destroy(itr);
+    regidx_destroy(idx);
+
+    if (units.empty()) std::cerr << "Warning: no region of <" << path << "> overlaps the contigs of the alignment files" << std::endl;
+
+    return 0;
+}
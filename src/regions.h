@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "htslib/htslib/sam.h"
+#include "units.h"
+
+// Default number of targeted positions in each work unit created from a regions file
+#define REGION_UNIT_SIZE 1048576
+
+
+// Load target regions from a BED file (parsed with regidx, 0-based half-open) and create work units covering them in header order.
+// Overlapping and adjacent regions are merged. Each unit is made of consecutive ranges, possibly on several contigs, totalling up to <unit_size>
+// positions (regions longer than <unit_size> are split), so that each input file is read once per unit with a multi-region iterator and the depth
+// matrix only holds targeted positions. Regions on contigs missing from <header> are ignored with a warning. Returns 1 if the file could not be read
+int make_region_units(const char *path, sam_hdr_t *header, uint32_t unit_size, std::vector<WorkUnit>& units);
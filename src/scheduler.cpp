@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <thread>
+#include "scheduler.h"
+
+
+std::vector<uint> schedule_order(const std::vector<uint64_t>& sizes) {
+
+    // Units by decreasing size, ties in output order
+    std::vector<uint> order(sizes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint a, uint b) { return sizes[a] > sizes[b]; });
+
+    return order;
+}
+
+
+ContigScheduler::ContigScheduler(const std::vector<uint64_t>& sizes, uint n_workers) : queues(std::max(n_workers, 1u)) {
+
+    // Deal units round-robin to the workers, largest first
+    std::vector<uint> order = schedule_order(sizes);
+    for (uint i=0; i<order.size(); ++i) this->queues[i % this->queues.size()].units.push_back(order[i]);
+}
+
+
+bool ContigScheduler::next(uint worker_n, uint& unit) {
+
+    // Take the largest unit left in the worker's own queue
+    {
+        WorkerQueue& own = this->queues[worker_n];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.units.empty()) {
+            unit = own.units.front();
+            own.units.pop_front();
+            return true;
+        }
+    }
+
+    // Steal the smallest unit from the next worker with work left
+    for (uint i=1; i<this->queues.size(); ++i) {
+        WorkerQueue& victim = this->queues[(worker_n + i) % this->queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.units.empty()) {
+            unit = victim.units.back();
+            victim.units.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool ContigScheduler::take(uint unit) {
+
+    for (auto& queue: this->queues) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto position = std::find(queue.units.begin(), queue.units.end(), unit);
+        if (position != queue.units.end()) {
+            queue.units.erase(position);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+OrderedOutput::OrderedOutput(uint n_units, std::ostream& out, const std::function<int(uint)>& written,
+                             const std::function<void(std::ostream&, uint, const std::string&)>& write, uint64_t max_buffered)
+    : out(out), written(written), write(write), pending(n_units), completed(n_units, false), max_buffered(max_buffered) {
+
+    this->next_unit = 0;
+}
+
+
+int OrderedOutput::submit(uint unit, std::string&& output) {
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->buffered += output.size();
+    this->pending[unit] = std::move(output);
+    this->completed[unit] = true;
+
+    bool drained = false;
+    while (this->next_unit < this->completed.size() && this->completed[this->next_unit]) {
+        std::string& ready = this->pending[this->next_unit];
+        if (this->write) {
+            this->write(this->out, this->next_unit, ready);
+        } else {
+            this->out.write(ready.data(), static_cast<std::streamsize>(ready.size()));
+        }
+        this->buffered -= ready.size();
+        std::string().swap(ready);  // Release memory for this unit
+        ++this->next_unit;
+        drained = true;
+        if (this->written && this->written(this->next_unit) != 0) return 1;
+    }
+    if (drained) this->drained.notify_all();  // The write cursor moved: waiting workers can take the new cursor unit or any unit
+
+    return 0;
+}
+
+
+bool OrderedOutput::wait(const std::function<bool(uint)>& take, uint& unit) {
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    // The unit at the write cursor is either taken here or being processed by another worker, which writes the buffered output when done
+    while (this->buffered > this->max_buffered && !this->aborted) {
+        if (take(this->next_unit)) {
+            unit = this->next_unit;
+            return true;
+        }
+        this->drained.wait(lock);
+    }
+
+    return false;
+}
+
+
+void OrderedOutput::abort() {
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->aborted = true;
+    this->drained.notify_all();
+}
+
+
+std::string UnitOutput::take() {
+
+    return std::move(this->output);
+}
+
+
+int UnitOutput::overflow(int c) {
+
+    if (c != traits_type::eof()) this->output.push_back(traits_type::to_char_type(c));
+    return traits_type::not_eof(c);
+}
+
+
+std::streamsize UnitOutput::xsputn(const char *data, std::streamsize size) {
+
+    this->output.append(data, static_cast<size_t>(size));
+    return size;
+}
+
+
+int run_scheduler(const std::vector<uint64_t>& sizes, uint n_workers, const std::function<int(uint, uint, std::ostream&)>& process, std::ostream& out,
+                  const std::function<int(uint)>& written, const std::function<void(std::ostream&, uint, const std::string&)>& write) {
+
+    ContigScheduler scheduler(sizes, n_workers);
+    OrderedOutput output(static_cast<uint>(sizes.size()), out, written, write);
+    std::atomic<bool> failed(false);
+
+    auto take = [&](uint unit) { return scheduler.take(unit); };
+    auto worker = [&](uint worker_n) {
+        uint unit = 0;
+        while (!failed && (output.wait(take, unit) || scheduler.next(worker_n, unit))) {
+            UnitOutput unit_buffer;
+            std::ostream unit_output(&unit_buffer);
+            if (process(worker_n, unit, unit_output) != 0 || output.submit(unit, unit_buffer.take()) != 0) {
+                failed = true;
+                output.abort();
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint i=0; i<n_workers; ++i) threads.emplace_back(worker, i);
+    for (auto& thread: threads) thread.join();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Maximum size in bytes of the output buffered for units waiting for previous units: past it, workers only take the unit at the write cursor
+// or wait for it, so that a large early unit finishing last does not hold the output of all later units in memory
+#define REORDER_BUFFER_SIZE (512ull << 20)
+
+
+// Order in which units of the given sizes are dealt to workers: largest first, ties in output order
+std::vector<uint> schedule_order(const std::vector<uint64_t>& sizes);
+
+
+// Distributes work units (contigs) to a set of workers. Units are dealt largest first, round-robin, into one queue per worker.
+// A worker takes units from the front of its own queue; when its queue is empty, it steals from the back of another worker's queue
+// (the smallest units of that worker), so that all workers finish at about the same time
+class ContigScheduler {
+
+    public:
+
+        // <sizes>: size of each unit (contig length), in output order
+        ContigScheduler(const std::vector<uint64_t>& sizes, uint n_workers);
+
+        // Get the next unit for worker <worker_n>. Returns false when there is no unit left
+        bool next(uint worker_n, uint& unit);
+
+        // Take unit <unit> from the queue holding it. Returns false if it was already taken
+        bool take(uint unit);
+
+    private:
+
+        struct WorkerQueue {
+            std::deque<uint> units;
+            std::mutex mutex;
+        };
+
+        std::vector<WorkerQueue> queues;
+};
+
+
+// Reorder buffer: units are completed in any order, and their output is written in unit order as soon as all previous units are written.
+// The output buffered for units waiting for previous units is bounded by <max_buffered> bytes, plus one unit per worker (see wait)
+class OrderedOutput {
+
+    public:
+
+        // <write>, if set, writes the output of a unit to the stream instead of a plain copy. <written>, if set, is called with the number of
+        // units written after each unit is written. Both are called under the lock, in unit order
+        OrderedOutput(uint n_units, std::ostream& out, const std::function<int(uint)>& written=nullptr,
+                      const std::function<void(std::ostream&, uint, const std::string&)>& write=nullptr, uint64_t max_buffered=REORDER_BUFFER_SIZE);
+
+        // Store the output of unit <unit> and write all units that are ready in order. Returns 1 if <written> failed
+        int submit(uint unit, std::string&& output);
+
+        // Called by a worker before taking a new unit. While the buffered output exceeds the limit, the worker takes the unit at the write
+        // cursor with take(unit) if no worker started it, or waits until the buffered output is written. Returns true if the unit at the write
+        // cursor was taken (stored in <unit>), false if the worker can take any unit or if the output was aborted
+        bool wait(const std::function<bool(uint)>& take, uint& unit);
+
+        // Wake up all waiting workers after a failure, and stop waiting from then on
+        void abort();
+
+    private:
+
+        std::ostream& out;
+        std::function<int(uint)> written;
+        std::function<void(std::ostream&, uint, const std::string&)> write;
+        std::vector<std::string> pending;  // Output of completed units waiting for previous units
+        std::vector<bool> completed;
+        uint next_unit;  // Next unit to write
+        uint64_t buffered = 0;  // Total size of the output in <pending>
+        uint64_t max_buffered;
+        bool aborted = false;
+        std::mutex mutex;
+        std::condition_variable drained;  // Notified when buffered output is written
+};
+
+
+// Output stream buffer appending to a string, so that the output of a unit is formatted directly into the string stored by OrderedOutput
+// (std::ostringstream can only return a copy of its content)
+class UnitOutput : public std::streambuf {
+
+    public:
+
+        // Content written so far, moved out of the buffer
+        std::string take();
+
+    protected:
+
+        int overflow(int c) override;
+        std::streamsize xsputn(const char *data, std::streamsize size) override;
+
+    private:
+
+        std::string output;
+};
+
+
+// Process all units with <n_workers> threads and write their output in unit order to <out>.
+// process(worker_n, unit, output) must fill <output> for <unit> and return 0 on success. write(out, unit, output), if set, writes the output
+// of a unit to <out> instead of a plain copy. written(n_units), if set, is called in order after each unit is written to <out> with the number
+// of units written so far, and must return 0 on success. The output of completed units waiting for previous units is bounded (see OrderedOutput).
+// Returns 1 if any unit failed; remaining units are not processed after a failure
+int run_scheduler(const std::vector<uint64_t>& sizes, uint n_workers, const std::function<int(uint, uint, std::ostream&)>& process, std::ostream& out,
+                  const std::function<int(uint)>& written=nullptr, const std::function<void(std::ostream&, uint, const std::string&)>& write=nullptr);
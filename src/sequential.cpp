@@ -0,0 +1,51 @@
+#include <iostream>
+#include "sequential.h"
+
+
+SequentialReader::~SequentialReader() {
+
+    if (this->b != nullptr) bam_destroy1(this->b);
+}
+
+
+int SequentialReader::open(inputFile *input, sam_hdr_t *header, const ReadFilter& filter) {
+
+    this->input = input;
+
+    // Contigs are matched by name, the header of the first file setting the order in which contigs are counted
+    for (int k=0; k<input->header->n_targets; ++k) {
+        int tid = sam_hdr_name2tid(header, input->header->target_name[k]);
+        if (tid < 0) {
+            std::cerr << "Error: contig <" << input->header->target_name[k] << "> of alignment file <" << input->sam->fn << "> is not in the first file" << std::endl;
+            return 1;
+        }
+        this->tids.push_back(tid);
+    }
+
+    this->b = bam_init1();
+    this->next(filter);
+
+    return 0;
+}
+
+
+void SequentialReader::next(const ReadFilter& filter) {
+
+    // Rejected alignments are skipped here, so that each alignment is only tested once
+    while ((this->result = sam_read1(this->input->sam, this->input->header, this->b)) >= 0) {
+        if (this->b->core.tid < 0) {
+            this->result = -1;
+            return;
+        }
+        // Alignments must come in the contig order of the first file, sorted by position within each contig
+        int tid = this->tids[static_cast<size_t>(this->b->core.tid)];
+        if (tid < this->tid || (tid == this->tid && this->b->core.pos < this->pos)) {
+            std::cerr << "Error: alignment file <" << this->input->sam->fn << "> is not sorted by coordinate in the contig order of the first file" << std::endl;
+            this->result = SEQUENTIAL_UNSORTED;
+            return;
+        }
+        this->tid = tid;
+        this->pos = this->b->core.pos;
+        if (filter.accept(this->b, this->input->filter_stats)) return;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include "htslib/htslib/sam.h"
+#include "filter.h"
+#include "input.h"
+
+// Value of SequentialReader::result when an alignment is out of order (the error is already reported)
+#define SEQUENTIAL_UNSORTED -100
+
+
+// Alignment file read once from start to end without an index. The file must be sorted by coordinate, with contigs in the order of the
+// header of the first input file: alignments are read ahead one at a time and routed to their contig by id, so moving to the next contig costs
+// no index lookup or seek. Unmapped alignments without a position (at the end of sorted files) end the file
+class SequentialReader {
+
+    public:
+
+        SequentialReader() {}
+        ~SequentialReader();
+
+        SequentialReader(const SequentialReader&) = delete;
+        SequentialReader& operator=(const SequentialReader&) = delete;
+
+        // Map the contigs of <input> to the contigs of <header> (header of the first input file) by name and read the first alignment
+        // accepted by <filter>. Returns 1 if a contig of <input> is not in <header>
+        int open(inputFile *input, sam_hdr_t *header, const ReadFilter& filter);
+
+        // Read the next alignment accepted by <filter> into <b>
+        void next(const ReadFilter& filter);
+
+        // True if the next alignment is on contig <tid> (id in the header of the first input file)
+        inline bool on_contig(int tid) const { return this->result >= 0 && this->tid == tid; }
+
+        inputFile *input = nullptr;
+        bam1_t *b = nullptr;  // Next alignment
+        int result = 0;  // Return value of the last call to sam_read1 (-1 at the end of the file, SEQUENTIAL_UNSORTED or < -1 on error)
+        int tid = 0;  // Contig of the next alignment, as an id in the header of the first input file
+        hts_pos_t pos = 0;  // Position of the next alignment
+
+    private:
+
+        std::vector<int> tids;  // Contig id in the header of the first input file for each contig id of this file
+};
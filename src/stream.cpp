@@ -0,0 +1,168 @@
+#include <iostream>
+#include <algorithm>
+#include "stream.h"
+#include "overlaps.h"
+#include "pileup.h"
+#include "sequential.h"
+#include "output.h"
+
+
+// State of an input file while streaming through a contig, or through the whole file
+struct StreamSource {
+    inputFile *input;
+    hts_itr_t *iter;  // Iterator over the contig, or nullptr when the whole file is read sequentially with <reader>
+    SequentialReader reader;  // Sequential reading of the whole file
+    bam1_t *b;  // Next alignment to count
+    int result;  // Return value of the last call to sam_itr_next or sam_read1
+    int tid;  // Contig of the next alignment, as an id in the header of the first input file
+    uint32_t needed_window;  // Window size required by the next alignment when it did not fit in the current window, 0 otherwise
+    MateOverlaps overlaps;  // Mates waiting for their overlapping mate, only used with filter.dedup_overlaps
+};
+
+
+// Smallest power of two >= n
+static uint32_t next_power_of_two(uint64_t n) {
+
+    uint64_t size = 1;
+    while (size < n) size <<= 1;
+    return static_cast<uint32_t>(std::min(size, static_cast<uint64_t>(UINT32_MAX / 2 + 1)));
+}
+
+
+// Load the next alignment accepted by the filter from a source. Rejected alignments are skipped here, so that each alignment is only tested once
+static void next_alignment(StreamSource& source, const ReadFilter& filter) {
+
+    if (source.iter == nullptr) {
+        source.reader.next(filter);
+        source.result = source.reader.result;
+        source.tid = source.reader.tid;
+        return;
+    }
+
+    while ((source.result = sam_itr_next(source.input->sam, source.iter, source.b)) >= 0 && !filter.accept(source.b, source.input->filter_stats)) {}
+}
+
+
+// Count all alignments from a source starting on contig <tid> before <target>. Stops early, without consuming the alignment, when the next alignment
+// does not fit in the window: in this case, the required window size is stored in <source.needed_window>
+static int advance_source(StreamSource& source, int tid, const char *contig, uint32_t target, uint32_t flushed, uint32_t start, uint32_t end, DepthMatrix& window, const ReadFilter& filter) {
+
+    source.needed_window = 0;
+
+    while (source.result >= 0 && source.tid == tid && source.b->core.pos < target) {
+        // The window must hold all positions from the first position not output yet to the end of the alignment
+        hts_pos_t span = std::min(bam_endpos(source.b), static_cast<hts_pos_t>(end)) - flushed;
+        if (span > static_cast<hts_pos_t>(window.n_rows)) {
+            source.needed_window = next_power_of_two(span);
+            return 0;
+        }
+        if (filter.dedup_overlaps) {
+            source.overlaps.count(source.b, window, source.input->file_n, start, end, filter.min_base_quality);
+        } else {
+            count_alignment(source.b, window, source.input->file_n, start, end, filter.min_base_quality);
+        }
+        next_alignment(source, filter);
+    }
+
+    if (source.result == SEQUENTIAL_UNSORTED) return 1;
+    if (source.result < -1) {
+        std::cerr << "Error processing region <" << contig << "> in file <" << source.input->sam->fn << "> due to truncated file or corrupt BAM index file" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Count positions [start, end) of contig <tid> from all sources and output them as soon as every source has moved past them
+static int stream_contig(std::vector<StreamSource>& sources, int tid, const char *contig, uint32_t start, uint32_t end, DepthMatrix& window, TaskPool& pool, std::ostream& out, const ReadFilter& filter,
+                         const OutputOptions& options, OutputState& state) {
+
+    if (window.reset_window(STREAM_MIN_WINDOW) != 0) return 1;
+
+    uint32_t flushed = start;  // All positions before <flushed> have been output
+
+    while (flushed < end) {
+
+        // Count all alignments starting before <target> in every file, then output positions up to <target>
+        uint32_t target = static_cast<uint32_t>(std::min(static_cast<uint64_t>(end), static_cast<uint64_t>(flushed) + window.n_rows / 2));
+
+        // Files are advanced in parallel, each one writing to its own block of the window. When an alignment does not fit in the window,
+        // the window is enlarged once all files have stopped, and the files are advanced again
+        uint32_t needed_window = 0;
+        do {
+            if (pool.run(static_cast<uint>(sources.size()), [&](uint i) { return advance_source(sources[i], tid, contig, target, flushed, start, end, window, filter); }) != 0) return 1;
+            needed_window = 0;
+            for (auto& source: sources) needed_window = std::max(needed_window, source.needed_window);
+            if (needed_window > 0 && window.resize_window(needed_window, flushed) != 0) return 1;
+        } while (needed_window > 0);
+
+        write_rows(out, window, flushed, target, options, state);
+        window.clear_rows(flushed, target);
+        flushed = target;
+    }
+
+    return 0;
+}
+
+
+int stream_region(std::vector<inputFile>& input, char *contig, uint32_t start, uint32_t end, DepthMatrix& window, TaskPool& pool, std::ostream& out, const ReadFilter& filter,
+                  const OutputOptions& options, OutputState& state) {
+
+    int return_value = 0;
+    std::vector<StreamSource> sources(input.size());
+    int tid = sam_hdr_name2tid(input[0].header, contig);
+
+    // Create an iterator on the range for each file && load its first alignment
+    for (uint i=0; i<input.size(); ++i) {
+        sources[i].input = &input[i];
+        sources[i].tid = tid;
+        sources[i].b = bam_init1();
+        int file_tid = sam_hdr_name2tid(input[i].header, contig);  // Contig ids can differ between files, contigs are matched by name
+        if (file_tid < 0 || (sources[i].iter = sam_itr_queryi(input[i].idx, file_tid, start, end)) == nullptr) {
+            std::cerr << "Region <" << contig << "> not found in index file" << std::endl;
+            return_value = 1;
+            goto end;
+        }
+        next_alignment(sources[i], filter);
+    }
+
+    return_value = stream_contig(sources, tid, contig, start, end, window, pool, out, filter, options, state);
+
+end:
+    for (auto& source: sources) {
+        if (source.iter) hts_itr_destroy(source.iter);
+        if (source.b) bam_destroy1(source.b);
+    }
+
+    return return_value;
+}
+
+
+int stream_files(std::vector<inputFile>& input, DepthMatrix& window, TaskPool& pool, std::ostream& out, const ReadFilter& filter, const OutputOptions& options,
+                 OutputState& state) {
+
+    std::vector<StreamSource> sources(input.size());
+    sam_hdr_t *header = input[0].header;
+
+    // Contigs are matched by name with the header of the first file, which sets the output order
+    for (uint i=0; i<input.size(); ++i) {
+        sources[i].input = &input[i];
+        if (sources[i].reader.open(&input[i], header, filter) != 0) return 1;
+        sources[i].b = sources[i].reader.b;
+        sources[i].result = sources[i].reader.result;
+        sources[i].tid = sources[i].reader.tid;
+    }
+
+    // The files are merged contig by contig: each contig is counted from the alignments of all files at the front of their stream
+    for (int tid=0; tid<header->n_targets; ++tid) {
+        char *contig = header->target_name[tid];
+        uint32_t contig_len = static_cast<uint32_t>(header->target_len[tid]);
+        std::cerr << "Processing contig " << contig << " (" << contig_len << " bp)" << std::endl;
+        write_region_header(out, contig, contig_len, options.format, state);
+        for (auto& source: sources) source.overlaps.clear();
+        if (stream_contig(sources, tid, contig, 0, contig_len, window, pool, out, filter, options, state) != 0) return 1;
+    }
+
+    return 0;
+}
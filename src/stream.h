@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+#include "depth_matrix.h"
+#include "filter.h"
+#include "input.h"
+#include "output.h"
+#include "task_pool.h"
+
+// Initial number of positions in the circular window. The window grows (power of two) when an alignment spans more positions
+#define STREAM_MIN_WINDOW 16384
+
+
+// Count all files for positions [start, end) of a contig in a circular window and output depths as soon as every input has moved past a position.
+// Memory usage depends on the longest alignment span and the number of files, not on the region length. Files are counted in parallel using <pool>.
+// Alignments rejected by <filter> are not counted. Depths are written with <options>, continuing the output <state>
+int stream_region(std::vector<inputFile>& input, char *contig, uint32_t start, uint32_t end, DepthMatrix& window, TaskPool& pool, std::ostream& out, const ReadFilter& filter,
+                  const OutputOptions& options, OutputState& state);
+
+// Count whole files read sequentially from start to end, without an index (files can be streamed from stdin or pipes), and output each contig
+// in header order of the first file as in stream_region, starting with its region header. The files are merged by position: they must be sorted
+// by coordinate with contigs in the order of the first file. Unmapped alignments without a position at the end of files are ignored
+int stream_files(std::vector<inputFile>& input, DepthMatrix& window, TaskPool& pool, std::ostream& out, const ReadFilter& filter, const OutputOptions& options,
+                 OutputState& state);
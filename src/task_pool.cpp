@@ -0,0 +1,77 @@
+#include "task_pool.h"
+
+
+TaskPool::TaskPool(uint n_threads) {
+
+    this->n_threads = (n_threads > 0) ? n_threads : 1;
+    this->task = nullptr;
+    this->n_tasks = 0;
+    this->next_task = 0;
+    this->status = 0;
+    this->busy = 0;
+    this->batch = 0;
+    this->stop = false;
+
+    for (uint i=1; i<this->n_threads; ++i) this->threads.emplace_back(&TaskPool::worker, this);
+}
+
+
+TaskPool::~TaskPool() {
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+    }
+    this->start_batch.notify_all();
+    for (auto& thread: this->threads) thread.join();
+}
+
+
+int TaskPool::run(uint n_tasks, const std::function<int(uint)>& task) {
+
+    if (n_tasks == 0) return 0;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->task = &task;
+        this->n_tasks = n_tasks;
+        this->next_task = 0;
+        this->status = 0;
+        this->busy = static_cast<uint>(this->threads.size());
+        ++this->batch;
+    }
+    this->start_batch.notify_all();
+
+    this->execute();
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->end_batch.wait(lock, [this]{ return this->busy == 0; });
+
+    return this->status;
+}
+
+
+void TaskPool::worker() {
+
+    uint64_t last_batch = 0;
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    while (true) {
+        this->start_batch.wait(lock, [&]{ return this->stop || this->batch != last_batch; });
+        if (this->stop) return;
+        last_batch = this->batch;
+        lock.unlock();
+        this->execute();
+        lock.lock();
+        if (--this->busy == 0) this->end_batch.notify_all();
+    }
+}
+
+
+void TaskPool::execute() {
+
+    uint i;
+    while ((i = this->next_task.fetch_add(1)) < this->n_tasks) {
+        if ((*this->task)(i) != 0) this->status = 1;
+    }
+}
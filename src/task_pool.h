@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of threads running batches of independent tasks (for instance one task per input file).
+// The thread calling run() takes part in the work, so a pool of 1 thread runs everything on the calling thread
+class TaskPool {
+
+    public:
+
+        TaskPool(uint n_threads);
+        ~TaskPool();
+
+        TaskPool(const TaskPool&) = delete;
+        TaskPool& operator=(const TaskPool&) = delete;
+
+        // Run task(i) for all i in [0, n_tasks) and wait for all tasks to complete. Returns 1 if any task returned a non-zero value
+        int run(uint n_tasks, const std::function<int(uint)>& task);
+
+        uint n_threads;  // Number of threads running tasks, including the calling thread
+
+    private:
+
+        void worker();  // Main loop of a pool thread
+        void execute();  // Run tasks from the current batch until there is none left
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable start_batch;  // Signaled when a new batch is available
+        std::condition_variable end_batch;  // Signaled when all pool threads are done with the current batch
+        const std::function<int(uint)> *task;  // Task function for the current batch
+        uint n_tasks;  // Number of tasks in the current batch
+        std::atomic<uint> next_task;  // Index of the next task to run in the current batch
+        std::atomic<int> status;  // Set to 1 if a task failed in the current batch
+        uint busy;  // Number of pool threads still working on the current batch
+        uint64_t batch;  // Batch number, incremented every time run() is called
+        bool stop;  // Set to true to terminate pool threads
+};
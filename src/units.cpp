@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <algorithm>
+#include "units.h"
+
+
+// Choose the boundary of the chunk starting at <previous> and ideally ending at <target> among the linear index windows around <target>: the
+// best boundary is the one for which the first alignment to read is closest to the beginning of its BGZF block (ideally at offset 0, i.e. a
+// fresh block), so that each chunk decompresses as little data from the previous chunk as possible. Only windows within CHUNK_SEARCH_WINDOWS
+// of <target> and giving a chunk of 0.5 to 1.5 times the chunk size are searched, so that chunks keep about the requested size. Without
+// offsets information (CRAM index, whose containers are not aligned on windows, or no candidate window with alignments), <target> is used
+static uint32_t choose_boundary(inputFile& input, int tid, uint32_t target, uint32_t previous, uint32_t contig_len) {
+
+    if (input.sam->format.format == cram) return target;
+
+    uint32_t half_chunk = (target - previous) / 2;
+    int64_t low = static_cast<int64_t>(previous) + half_chunk;  // Candidates are in [low, high)
+    int64_t high = std::min(static_cast<int64_t>(target) + half_chunk, static_cast<int64_t>(contig_len));
+    int64_t base = target / LINEAR_INDEX_WINDOW * LINEAR_INDEX_WINDOW;
+    uint32_t best = target;
+    uint32_t best_block_offset = UINT32_MAX;
+    int64_t best_distance = INT64_MAX;
+
+    for (int k=-CHUNK_SEARCH_WINDOWS; k<=CHUNK_SEARCH_WINDOWS; ++k) {
+        int64_t candidate = base + static_cast<int64_t>(k) * LINEAR_INDEX_WINDOW;
+        if (candidate < low || candidate >= high) continue;
+        hts_itr_t *iter = sam_itr_queryi(input.idx, tid, candidate, candidate + 1);
+        if (iter == nullptr) continue;
+        if (iter->n_off > 0) {
+            uint32_t block_offset = static_cast<uint32_t>(iter->off[0].u & 0xffff);  // Offset of the first alignment in its uncompressed BGZF block
+            int64_t distance = llabs(candidate - static_cast<int64_t>(target));
+            if (block_offset < best_block_offset || (block_offset == best_block_offset && distance < best_distance)) {
+                best = static_cast<uint32_t>(candidate);
+                best_block_offset = block_offset;
+                best_distance = distance;
+            }
+        }
+        hts_itr_destroy(iter);
+    }
+
+    return best;
+}
+
+
+std::vector<WorkUnit> make_units(inputFile& input, uint32_t chunk_size, uint32_t batch_size) {
+
+    std::vector<WorkUnit> units;
+    WorkUnit batch = {0, 0, 0, {}};  // Batch of small contigs being filled
+
+    // A batch is closed when it reaches <batch_size> positions or before a contig too long to be batched; a batch of one contig is a normal unit
+    auto close_batch = [&]() {
+        if (batch.ranges.size() == 1) {
+            units.push_back({batch.tid, 0, batch.end, {}});
+        } else if (batch.ranges.size() > 1) {
+            units.push_back(batch);
+        }
+        batch = {0, 0, 0, {}};
+    };
+
+    for (int tid=0; tid<input.header->n_targets; ++tid) {
+        uint32_t contig_len = input.header->target_len[tid];
+        if (contig_len > 0 && contig_len < batch_size) {
+            if (batch.ranges.empty()) batch.tid = tid;
+            batch.ranges.push_back({tid, 0, contig_len, batch.end, 0, contig_len});
+            batch.end += contig_len;
+            if (batch.end >= batch_size) close_batch();
+            continue;
+        }
+        close_batch();
+        uint32_t start = 0;
+        if (chunk_size > 0) {
+            while (contig_len - start > chunk_size) {
+                uint32_t boundary = choose_boundary(input, tid, start + chunk_size, start, contig_len);
+                if (boundary <= start || boundary >= contig_len) boundary = start + chunk_size;
+                units.push_back({tid, start, boundary, {}});
+                start = boundary;
+            }
+        }
+        units.push_back({tid, start, contig_len, {}});
+    }
+    close_batch();
+
+    return units;
+}
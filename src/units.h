@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "input.h"
+
+// Size of a window of the BAI linear index (also the default min_shift of CSI indexes). Chunk boundaries are multiples of this size
+#define LINEAR_INDEX_WINDOW 16384
+
+// Maximum number of linear index windows searched on each side of the ideal boundary when splitting a contig into chunks (windows are only
+// searched within half a chunk of the ideal boundary)
+#define CHUNK_SEARCH_WINDOWS 4
+
+// Default total length of the batches of small contigs processed as a single unit
+#define BATCH_SIZE 1048576
+
+
+// Range of positions of a contig in a work unit made of several ranges. The ranges of a unit are stored one after the other in its depth matrix
+struct UnitRange {
+    int tid;  // Contig id in the header of the first input file
+    uint32_t start;  // First position of the range (0-based)
+    uint32_t end;  // Position following the last position of the range
+    uint32_t row;  // Position of the depth matrix holding <start> (the matrix position of contig position p is p - start + row)
+    uint32_t region_start;  // First position of the target region containing the range (regions longer than a unit are split into several ranges)
+    uint32_t region_end;  // Position following the last position of the target region containing the range
+};
+
+
+// Range of positions of a contig processed as one unit of work, or set of ranges (target regions, batch of small contigs) processed together
+struct WorkUnit {
+    int tid;  // Contig id in the header of the first input file (contig of the first range for a unit made of several ranges)
+    uint32_t start;  // First position of the range (0-based), or first matrix position (0) for a unit made of several ranges
+    uint32_t end;  // Position following the last position of the range, or number of matrix positions for a unit made of several ranges
+    std::vector<UnitRange> ranges;  // Ranges of a unit made of several ranges, in output order (empty for a single range)
+};
+
+
+// Create work units for all contigs in header order. Contigs longer than <chunk_size> are split into consecutive chunks of about <chunk_size> positions;
+// with <chunk_size> = 0, each contig is a single unit. Chunk boundaries are chosen from the BAM index of <input>, within half a chunk of the
+// ideal boundary, so that reading each chunk starts as close as possible to the beginning of a BGZF block.
+// Consecutive contigs shorter than <batch_size> are packed into batches of about <batch_size> positions, each batch being a single unit made of
+// one range per contig (see UnitRange), so that small contigs share the per-unit costs (iterators, matrix reset, output). 0: no batching
+std::vector<WorkUnit> make_units(inputFile& input, uint32_t chunk_size, uint32_t batch_size=0);
@@ -0,0 +1,141 @@
+#!/bin/bash
+# Benchmarks of the performance changes, on inputs generated from the sample files by test/make_bench_input.cpp, with the output written to
+# /dev/null. Usage: test/bench.sh [program] [benchmark ...] (default: bin/test, all benchmarks). Prints the best wall time and the max RSS
+# of BENCH_RUNS runs (default: 3) of each configuration; to compare two revisions, run it with the program built from each of them.
+# The generator is compiled against HTSLIB (default: include/htslib/libhts.a)
+
+PROGRAM=${1:-bin/test}
+shift
+TEST_DIR=$(dirname "$0")
+HTSLIB=${HTSLIB:-$TEST_DIR/../include/htslib/libhts.a}
+RUNS=${BENCH_RUNS:-3}
+BENCHMARKS=${*:-depth_matrix decode_threads counting min_base_quality text_output cram_fields}
+
+# Contigs of the sample files' header. All alignments are on CONTIG (51 kb)
+CONTIG=tig00000018_pilon
+CONTIG_12=tig00000012_pilon  # 14 kb
+CONTIG_15=tig00000015_pilon  # 8.4 Mb
+CONTIG_20=tig00000020_pilon  # 7.9 Mb
+CONTIG_22=tig00000022_pilon  # 14 kb
+CONTIG_30=tig00000030_pilon  # 74 kb
+CONTIG_60=tig00000060_pilon  # 335 kb
+
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "$TMP_DIR"' EXIT
+
+if ! ${CXX:-g++} -std=c++11 -O2 -I "$TEST_DIR/../include" -o "$TMP_DIR/make_bench_input" "$TEST_DIR/make_bench_input.cpp" "$HTSLIB" \
+        -pthread -lz -llzma -lbz2; then
+    echo "Error compiling the benchmark input generator"
+    exit 1
+fi
+
+
+# Generate the inputs <name> (sample_f and sample_m, BAM and CRAM, and their reference) with a header declaring only <contigs>
+# (comma-separated) and each alignment written <copies> times, unless they already exist
+make_input() {
+    local name=$1 copies=$2 contigs=$3
+    [ -d "$TMP_DIR/$name" ] && return
+    mkdir "$TMP_DIR/$name"
+    for file in sample_f sample_m; do
+        if ! "$TMP_DIR/make_bench_input" "$TEST_DIR/sample.fa" "$TEST_DIR/$file.bam" "$copies" "$contigs" "$TMP_DIR/$name"; then
+            echo "Error generating benchmark input $name"
+            exit 1
+        fi
+    done
+}
+
+
+# Print the program's input files for the inputs <name> in format <extension> (bam or cram)
+inputs() {
+    local name=$1 extension=$2
+    echo "$TMP_DIR/$name/reference.fa $TMP_DIR/$name/sample_f.$extension $TMP_DIR/$name/sample_m.$extension"
+}
+
+
+# Run the program RUNS times with the given arguments and print <label> with the best wall time and the max RSS
+measure() {
+    local label=$1
+    shift
+    python3 - "$label" "$RUNS" "$PROGRAM" "$@" <<'EOF' || exit 1
+import resource, subprocess, sys, time
+
+label, runs, command = sys.argv[1], int(sys.argv[2]), sys.argv[3:]
+best = None
+for _ in range(runs):
+    start = time.time()
+    if subprocess.run(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode != 0:
+        sys.exit('Error running %s' % ' '.join(command))
+    elapsed = time.time() - start
+    best = elapsed if best is None else min(best, elapsed)
+print('%-50s wall %7.2f s   max RSS %5d MB' % (label, best, resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss // 1024))
+EOF
+}
+
+
+# Depth storage (DepthMatrix): several Mb long contigs, where the depth rows are allocated and zeroed for each contig
+bench_depth_matrix() {
+    make_input matrix 1 "$CONTIG_15,$CONTIG_20,$CONTIG"
+    measure "3 contigs, 16.3 Mb, BAM" $(inputs matrix bam)
+}
+
+
+# Decoding on the shared htslib thread pool (-d): 1.03 M alignments (sample alignments x50) on one contig
+bench_decode_threads() {
+    make_input replicated 50 "$CONTIG"
+    for extension in bam cram; do
+        for threads in 0 1 2 4; do
+            measure "1.03 M alignments, ${extension^^}, -d $threads" -d $threads $(inputs replicated $extension)
+        done
+    done
+}
+
+
+# Counting of aligned bases (nucleotide lookup tables): 1.03 M alignments, 153.5 M aligned bases, with only variable positions written (-V)
+# so that the run time is mostly decoding and counting
+bench_counting() {
+    make_input replicated 50 "$CONTIG"
+    measure "153.5 M aligned bases, BAM, -V" -V $(inputs replicated bam)
+}
+
+
+# Minimum base quality (-Q) inside the count kernels: the counting benchmark with each kernel (PILEUP_KERNEL, see src/count_kernel.h),
+# without and with a threshold
+bench_min_base_quality() {
+    make_input replicated 50 "$CONTIG"
+    for kernel in scalar sse4.2 avx2; do
+        for quality in 0 20; do
+            PILEUP_KERNEL=$kernel measure "153.5 M aligned bases, BAM, -V, $kernel, -Q $quality" -V -Q $quality $(inputs replicated bam)
+        done
+    done
+}
+
+
+# Text output formatting and writing: the sample alignments with headers of 4 contigs, short (154 kb) and long (16.6 Mb), so that the
+# run time is mostly output
+bench_text_output() {
+    make_input short 1 "$CONTIG_12,$CONTIG,$CONTIG_22,$CONTIG_30"
+    make_input long 1 "$CONTIG,$CONTIG_15,$CONTIG_20,$CONTIG_60"
+    measure "4 contigs, 154 kb, BAM" $(inputs short bam)
+    measure "4 contigs, 16.6 Mb, BAM" $(inputs long bam)
+}
+
+
+# Decoding of the CRAM fields used for counting only: the sample CRAM files with a header of 4 contigs and small output (-V), with the
+# default fields and with the qualities and read names needed by -Q and -D, then the sample CRAM files themselves, whose header declares
+# 3037 contigs
+bench_cram_fields() {
+    make_input short 1 "$CONTIG_12,$CONTIG,$CONTIG_22,$CONTIG_30"
+    measure "4 contigs, 154 kb, CRAM, -V" -V $(inputs short cram)
+    measure "4 contigs, 154 kb, CRAM, -V -Q 20 -D" -V -Q 20 -D $(inputs short cram)
+    measure "3037 contigs, CRAM, -V" -V "$TEST_DIR/sample.fa" "$TEST_DIR/sample_f.cram" "$TEST_DIR/sample_m.cram"
+}
+
+
+for benchmark in $BENCHMARKS; do
+    if ! declare -F "bench_$benchmark" > /dev/null; then
+        echo "Unknown benchmark <$benchmark>"
+        exit 1
+    fi
+    echo "== $benchmark"
+    "bench_$benchmark"
+done
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+# Convert binary output (-b, format described in src/output.h) read from stdin to the text format, for the contigs given as arguments
+# (all contigs if none). The output is read in one pass, so that a whole-genome binary output can be piped without being stored
+import struct
+import sys
+
+BINARY_MAGIC = b'PLPDEPTH'
+BINARY_INDEX_MAGIC = b'PLPINDEX'
+BINARY_VERSION = 2
+BINARY_COUNT_ESCAPE = 0xffff
+READ_SIZE = 1 << 24
+
+
+def read_exactly(stream, size):
+    data = stream.read(size)
+    if len(data) != size:
+        sys.exit('Error: truncated binary output')
+    return data
+
+
+def skip(stream, size):
+    while size > 0:
+        size -= len(read_exactly(stream, min(size, READ_SIZE)))
+
+
+def main():
+    stream = sys.stdin.buffer
+    selected = set(sys.argv[1:])
+
+    header = read_exactly(stream, 28)
+    if header[:8] != BINARY_MAGIC:
+        sys.exit('Error: not a binary output')
+    version, width, n_counters, n_files, n_contigs = struct.unpack_from('<5I', header, 8)
+    if version != BINARY_VERSION or width != 2:
+        sys.exit('Error: unsupported binary output version %d' % version)
+    offset = 28
+    files = []
+    for _ in range(n_files):
+        length, = struct.unpack('<I', read_exactly(stream, 4))
+        files.append(read_exactly(stream, length).decode())
+        offset += 4 + length
+    contigs = []
+    for _ in range(n_contigs):
+        length, = struct.unpack('<I', read_exactly(stream, 4))
+        name = read_exactly(stream, length).decode()
+        contig_length, = struct.unpack('<I', read_exactly(stream, 4))
+        contigs.append((name, contig_length))
+        offset += 8 + length
+    padding = (8 - offset % 8) % 8
+    skip(stream, padding)
+    offset += padding
+
+    # Contig blocks, in header order: only the selected ones are kept
+    row_size = n_files * n_counters
+    first_block = offset
+    blocks = {}
+    for name, contig_length in contigs:
+        size = contig_length * row_size * width
+        if not selected or name in selected:
+            blocks[name] = (offset, read_exactly(stream, size))
+        else:
+            skip(stream, size)
+        offset += size
+
+    # Escape table and index, after the last block (offsets in the index are from the start of the output)
+    trailer = stream.read()
+    if trailer[-8:] != BINARY_INDEX_MAGIC:
+        sys.exit('Error: missing binary index')
+    index_offset, = struct.unpack_from('<Q', trailer, len(trailer) - 16)
+    escapes_offset, n_escapes = struct.unpack_from('<2Q', trailer, index_offset - offset + 8 * n_contigs)
+    escapes = {}
+    for i in range(n_escapes):
+        index, count, _ = struct.unpack_from('<QII', trailer, escapes_offset - offset + 16 * i)
+        escapes[index] = count
+
+    out = sys.stdout
+    out.write('#Files\t' + '\t'.join(files) + '\n')
+    for name, contig_length in contigs:
+        if name not in blocks:
+            continue
+        out.write('region=%s\tlen=%d\n' % (name, contig_length))
+        block_offset, block = blocks[name]
+        counts = list(struct.unpack('<%dH' % (contig_length * row_size), block))
+        base = (block_offset - first_block) // width
+        for i, count in enumerate(counts):
+            if count == BINARY_COUNT_ESCAPE:
+                counts[i] = escapes[base + i]
+        for position in range(contig_length):
+            row = counts[position * row_size:(position + 1) * row_size]
+            out.write('\t'.join(','.join(map(str, row[k * n_counters:(k + 1) * n_counters])) for k in range(n_files)) + '\n')
+
+
+if __name__ == '__main__':
+    main()
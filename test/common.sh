@@ -0,0 +1,58 @@
+# Shared setup of the test scripts, sourced by test/test_*.sh. Usage of a test script: test/test_<name>.sh [program] (default: bin/test),
+# returning 1 if any check failed
+
+PROGRAM=${1:-bin/test}
+TEST_DIR=$(dirname "$0")
+INPUTS="$TEST_DIR/sample.fa $TEST_DIR/sample_f.bam $TEST_DIR/sample_m.bam"
+CONTIG=tig00000018_pilon  # All alignments of the sample files are on this contig, the only one of sample.fa
+CONTIG_LENGTH=$(cut -f 2 "$TEST_DIR/sample.fa.fai")
+
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "$TMP_DIR"' EXIT
+printf "%s\t0\t%s\n" "$CONTIG" "$CONTIG_LENGTH" > "$TMP_DIR/contig.bed"
+
+n_failed=0
+
+
+# Run the program with the given options on the sample files, only on the contig with alignments (unless other regions are given with -R),
+# writing the output to <output>
+run() {
+    local output=$1
+    shift
+    if ! "$PROGRAM" -R "$TMP_DIR/contig.bed" "$@" $INPUTS > "$output" 2> "$TMP_DIR/log.txt"; then
+        echo "Error running $PROGRAM $*:"
+        cat "$TMP_DIR/log.txt"
+        exit 1
+    fi
+}
+
+
+# Report check <name> as passed if <status> is 0, as failed otherwise
+report() {
+    local name=$1 status=$2
+    if [ "$status" -eq 0 ]; then
+        echo "OK      $name"
+    else
+        echo "FAILED  $name"
+        n_failed=$((n_failed + 1))
+    fi
+}
+
+
+# Report whether outputs <expected> and <observed> are identical, ignoring the #Files line
+check() {
+    local name=$1 expected=$2 observed=$3
+    cmp -s <(tail -n +2 "$expected") <(tail -n +2 "$observed")
+    report "$name" $?
+}
+
+
+# Print the result of the script and exit with its status
+finish() {
+    if [ $n_failed -gt 0 ]; then
+        echo "$n_failed check(s) failed"
+        exit 1
+    fi
+    echo "All checks passed"
+    exit 0
+}
@@ -0,0 +1,162 @@
+// Generator of the benchmark inputs of test/bench.sh, from the sample files of this directory.
+// Usage: make_bench_input <reference.fa> <alignments.bam> <copies> <contigs> <output directory>
+// Writes, in <output directory>, with the name of <alignments.bam>:
+// - a BAM and a CRAM file (indexed) whose header only declares <contigs> (comma-separated), with the alignments of <alignments.bam> on these
+//   contigs, each one written <copies> times
+// - reference.fa (indexed), the reference of the CRAM file: the sequences of <contigs> found in <reference.fa>, Ns for the others
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "htslib/htslib/faidx.h"
+#include "htslib/htslib/sam.h"
+
+
+// Split comma-separated <list> into <items>
+void split_list(const std::string& list, std::vector<std::string>& items) {
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+
+// Write the reference of <contigs> (with lengths <lengths>) to <output_path>, taking sequences from <reference_path> and filling contigs it
+// does not contain with Ns. Returns 1 on error
+int write_reference(const std::string& reference_path, const std::vector<std::string>& contigs, const std::vector<hts_pos_t>& lengths,
+                    const std::string& output_path) {
+    faidx_t* reference = fai_load(reference_path.c_str());
+    if (reference == NULL) {
+        std::cerr << "Error loading reference <" << reference_path << ">" << std::endl;
+        return 1;
+    }
+    FILE* output = fopen(output_path.c_str(), "w");
+    if (output == NULL) {
+        std::cerr << "Error opening output reference <" << output_path << ">" << std::endl;
+        fai_destroy(reference);
+        return 1;
+    }
+    for (size_t i = 0; i < contigs.size(); ++i) {
+        std::string sequence(lengths[i], 'N');
+        if (faidx_has_seq(reference, contigs[i].c_str())) {
+            hts_pos_t length = 0;
+            char* fetched = faidx_fetch_seq64(reference, contigs[i].c_str(), 0, lengths[i] - 1, &length);
+            if (fetched != NULL) sequence.replace(0, length, fetched, length);
+            free(fetched);
+        }
+        fprintf(output, ">%s\n", contigs[i].c_str());
+        for (hts_pos_t position = 0; position < lengths[i]; position += 80) fprintf(output, "%s\n", sequence.substr(position, 80).c_str());
+    }
+    fclose(output);
+    fai_destroy(reference);
+    return fai_build(output_path.c_str()) == 0 ? 0 : 1;
+}
+
+
+// Write the alignments of <input> (header <header>, index <index>) on <contigs> to <output_path>, in format <mode>, with header
+// <output_header>, each one <copies> times, and index the file. Returns 1 on error
+int write_alignments(htsFile* input, sam_hdr_t* header, hts_idx_t* index, const std::vector<std::string>& contigs, int copies,
+                     sam_hdr_t* output_header, const std::string& output_path, const char* mode, const std::string& reference_path) {
+    htsFile* output = hts_open(output_path.c_str(), mode);
+    if (output == NULL) {
+        std::cerr << "Error opening output <" << output_path << ">" << std::endl;
+        return 1;
+    }
+    int return_value = 0;
+    bam1_t* alignment = bam_init1();
+    if (output->format.format == cram and hts_set_opt(output, CRAM_OPT_REFERENCE, reference_path.c_str()) != 0) {
+        std::cerr << "Error setting the reference of <" << output_path << ">" << std::endl;
+        return_value = 1;
+        goto end;
+    }
+    if (sam_hdr_write(output, output_header) < 0) {
+        std::cerr << "Error writing the header of <" << output_path << ">" << std::endl;
+        return_value = 1;
+        goto end;
+    }
+    for (int tid = 0; tid < static_cast<int>(contigs.size()); ++tid) {
+        int input_tid = sam_hdr_name2tid(header, contigs[tid].c_str());
+        hts_itr_t* iterator = sam_itr_queryi(index, input_tid, 0, sam_hdr_tid2len(header, input_tid));
+        while (iterator != NULL and return_value == 0 and sam_itr_next(input, iterator, alignment) >= 0) {
+            // Mates on contigs that are not kept become unpaired
+            alignment->core.tid = tid;
+            alignment->core.mtid = alignment->core.mtid < 0 ? -1
+                                   : sam_hdr_name2tid(output_header, sam_hdr_tid2name(header, alignment->core.mtid));
+            if (alignment->core.mtid < 0) alignment->core.flag &= ~BAM_FPROPER_PAIR;
+            for (int copy = 0; copy < copies; ++copy) {
+                if (sam_write1(output, output_header, alignment) < 0) {
+                    std::cerr << "Error writing alignments to <" << output_path << ">" << std::endl;
+                    return_value = 1;
+                    break;
+                }
+            }
+        }
+        hts_itr_destroy(iterator);
+    }
+
+end:
+    bam_destroy1(alignment);
+    if (hts_close(output) != 0) return_value = 1;
+    if (return_value == 0 and sam_index_build(output_path.c_str(), 0) != 0) {
+        std::cerr << "Error indexing <" << output_path << ">" << std::endl;
+        return_value = 1;
+    }
+    return return_value;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc != 6) {
+        std::cerr << "Usage: make_bench_input <reference.fa> <alignments.bam> <copies> <contigs> <output directory>" << std::endl;
+        return 1;
+    }
+    std::string reference_path = argv[1], alignments_path = argv[2], output_directory = argv[5];
+    int copies = atoi(argv[3]);
+    std::vector<std::string> contigs;
+    split_list(argv[4], contigs);
+    std::string name = alignments_path.substr(alignments_path.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    std::string output_reference = output_directory + "/reference.fa";
+
+    int return_value = 0;
+    std::vector<hts_pos_t> lengths;
+    std::string header_text = "@HD\tVN:1.6\tSO:coordinate\n";
+    sam_hdr_t* output_header = NULL;
+    hts_idx_t* index = NULL;
+    sam_hdr_t* header = NULL;
+    htsFile* input = hts_open(alignments_path.c_str(), "r");
+    if (input == NULL or (header = sam_hdr_read(input)) == NULL or (index = sam_index_load(input, alignments_path.c_str())) == NULL) {
+        std::cerr << "Error opening indexed alignment file <" << alignments_path << ">" << std::endl;
+        return_value = 1;
+        goto end;
+    }
+
+    for (const std::string& contig: contigs) {
+        int tid = sam_hdr_name2tid(header, contig.c_str());
+        if (tid < 0) {
+            std::cerr << "Contig <" << contig << "> not found in <" << alignments_path << ">" << std::endl;
+            return_value = 1;
+            goto end;
+        }
+        lengths.push_back(sam_hdr_tid2len(header, tid));
+        header_text += "@SQ\tSN:" + contig + "\tLN:" + std::to_string(lengths.back()) + "\n";
+    }
+    output_header = sam_hdr_parse(header_text.size(), header_text.c_str());
+
+    if (write_reference(reference_path, contigs, lengths, output_reference) != 0 or
+        write_alignments(input, header, index, contigs, copies, output_header, output_directory + "/" + name + ".bam", "wb", output_reference) != 0 or
+        write_alignments(input, header, index, contigs, copies, output_header, output_directory + "/" + name + ".cram", "wc", output_reference) != 0) {
+        return_value = 1;
+    }
+
+end:
+    if (output_header != NULL) sam_hdr_destroy(output_header);
+    if (index != NULL) hts_idx_destroy(index);
+    if (header != NULL) sam_hdr_destroy(header);
+    if (input != NULL) hts_close(input);
+    return return_value;
+}
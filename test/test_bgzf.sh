@@ -0,0 +1,65 @@
+#!/bin/bash
+# BGZF output (-z -o): the decompressed output is the text output, and every line found with the position index (.pidx, see src/output.h)
+# is the line of that position in the whole contig output, for whole contigs and for target regions (-R) not starting at the contig start
+source "$(dirname "$0")/common.sh"
+
+
+# Check that the .pidx entries of BGZF output <compressed> point to the right lines, and that following the documented reading procedure
+# gives the line of every output position, using <reference>, the text output of the whole contig
+check_position_index() {
+    local name=$1 compressed=$2 reference=$3
+    python3 - "$compressed" "$compressed.pidx" "$reference" "$CONTIG" <<'EOF'
+import bisect, gzip, sys
+
+compressed, index_path, reference_path, contig = sys.argv[1:]
+output = gzip.open(compressed, 'rb').read()
+reference = [line for line in open(reference_path, 'rb').read().split(b'\n')[1:] if line[:1].isdigit()]
+
+lines = open(index_path).read().splitlines()
+magic, version, interval = lines[0].split('\t')
+assert (magic, version) == ('#pileup_pidx', '1'), lines[0]
+entries = [(name, int(position), int(offset)) for name, position, offset in (line.split('\t') for line in lines[1:])]
+assert entries and all(name == contig for name, _, _ in entries), 'entries of unexpected contigs'
+
+def line_at(offset):
+    return output[offset:output.index(b'\n', offset)]
+
+# Each entry is the line of its position
+for _, position, offset in entries:
+    assert line_at(offset) == reference[position], 'wrong line for position %d' % position
+
+# Reading procedure for every output position: last entry with a position of at most p, then skip p - position lines
+positions = [position for _, position, _ in entries]
+offset = 0
+region_start = None
+for line in output.split(b'\n'):
+    if line.startswith(b'region='):
+        region = line[7:].split(b'\t')[0].decode()
+        region_start = int(region.rsplit(':', 1)[1].split('-')[0]) - 1 if ':' in region else 0
+        position = region_start
+    elif line[:1].isdigit():
+        k = bisect.bisect_right(positions, position) - 1
+        assert k >= 0 and positions[k] >= region_start, 'no entry in the region of position %d' % position
+        entry_offset = entries[k][2]
+        for _ in range(position - positions[k]):
+            entry_offset = output.index(b'\n', entry_offset) + 1
+        assert line_at(entry_offset) == reference[position] == line, 'wrong line read for position %d' % position
+        position += 1
+EOF
+    report "$name" $?
+}
+
+
+run "$TMP_DIR/contig.txt"
+
+# Whole contig
+run /dev/null -z -o "$TMP_DIR/contig.txt.gz"
+check "decompressed output" "$TMP_DIR/contig.txt" <(gzip -dc "$TMP_DIR/contig.txt.gz")
+check_position_index "position index" "$TMP_DIR/contig.txt.gz" "$TMP_DIR/contig.txt"
+
+# Target regions, one of them split into several units (-c)
+printf "%s\t100\t20000\n%s\t30000\t%s\n" "$CONTIG" "$CONTIG" "$CONTIG_LENGTH" > "$TMP_DIR/regions.bed"
+run /dev/null -R "$TMP_DIR/regions.bed" -c 7000 -z -o "$TMP_DIR/regions.txt.gz"
+check_position_index "position index, -R" "$TMP_DIR/regions.txt.gz" "$TMP_DIR/contig.txt"
+
+finish
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Binary output (-b): converted to text with binary_to_text.py, it is identical to the text output, with and without -D
+source "$(dirname "$0")/common.sh"
+
+
+# Run the program with binary output (which has no region option: the whole header is written, and only the contig with alignments is
+# converted to text), writing the text output to <output>
+run_binary() {
+    local output=$1
+    shift
+    set -o pipefail
+    if ! "$PROGRAM" -b "$@" $INPUTS 2> "$TMP_DIR/log.txt" | python3 "$TEST_DIR/binary_to_text.py" "$CONTIG" > "$output"; then
+        echo "Error running $PROGRAM -b $*:"
+        cat "$TMP_DIR/log.txt"
+        exit 1
+    fi
+    set +o pipefail
+}
+
+
+run "$TMP_DIR/text.txt"
+
+run "$TMP_DIR/dedup.txt" -D
+
+run_binary "$TMP_DIR/binary.txt"
+run_binary "$TMP_DIR/binary_dedup.txt" -D
+check "binary output" "$TMP_DIR/text.txt" "$TMP_DIR/binary.txt"
+check "binary output, -D" "$TMP_DIR/dedup.txt" "$TMP_DIR/binary_dedup.txt"
+
+finish
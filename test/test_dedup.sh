@@ -0,0 +1,27 @@
+#!/bin/bash
+# Overlapping mates counted once (-D): the output does not depend on how the contig is split into units and processed (chunks, workers,
+# threads), and -D counts are never above the counts without -D, with at least one smaller count (the sample files have overlapping mates)
+source "$(dirname "$0")/common.sh"
+
+
+# Report whether every count of output <smaller> is at most the same count of output <larger>, with at least one smaller count
+check_smaller() {
+    local name=$1 larger=$2 smaller=$3
+    paste "$larger" "$smaller" | awk -F '[\t,]' '
+        /^(#|region=)/ { next }
+        { n = NF / 2; for (i=1; i<=n; ++i) { if ($(i + n) > $i) exit 1; if ($(i + n) < $i) fewer = 1 } }
+        END { exit !fewer }'
+    report "$name" $?
+}
+
+
+run "$TMP_DIR/text.txt"
+run "$TMP_DIR/dedup.txt" -D
+check_smaller "-D counts at most counts without -D" "$TMP_DIR/text.txt" "$TMP_DIR/dedup.txt"
+
+for options in "-c 5000" "-c 777 -w 3" "-t 2"; do
+    run "$TMP_DIR/dedup_units.txt" -D $options
+    check "-D, $options" "$TMP_DIR/dedup.txt" "$TMP_DIR/dedup_units.txt"
+done
+
+finish
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Counting kernels: each kernel forced with PILEUP_KERNEL (see src/count_kernel.h) is the one reported at startup (or the scalar kernel
+# if the CPU does not support it), and the vector kernels (avx2, sse4.2) give the same output as the scalar kernel, with and without a
+# minimum base quality (-Q, applied inside the kernels) and with overlapping mates counted once (-D, which also counts with the kernels)
+source "$(dirname "$0")/common.sh"
+
+
+# Check that the kernel reported in the log of the last run is <expected>
+check_kernel() {
+    local name=$1 expected=$2
+    grep -qx "Counting kernel: $expected" "$TMP_DIR/log.txt"
+    report "$name" $?
+}
+
+
+# Kernel selected when <kernel> is forced on this CPU
+supported() {
+    local kernel=$1 flag=$2
+    if grep -qw "$flag" /proc/cpuinfo 2>/dev/null; then echo "$kernel"; else echo scalar; fi
+}
+
+
+for options in "" "-Q 20" "-D"; do
+    suffix=${options:+, $options}
+    PILEUP_KERNEL=scalar run "$TMP_DIR/scalar.txt" $options
+    check_kernel "scalar kernel selected$suffix" scalar
+    for kernel in sse4.2 avx2; do
+        flag=${kernel/./_}
+        PILEUP_KERNEL=$kernel run "$TMP_DIR/$kernel.txt" $options
+        check_kernel "$kernel kernel selected$suffix" "$(supported "$kernel" "$flag")"
+        check "$kernel kernel, same output as scalar$suffix" "$TMP_DIR/scalar.txt" "$TMP_DIR/$kernel.txt"
+    done
+done
+
+finish
@@ -0,0 +1,49 @@
+#!/bin/bash
+# Readahead (-A): the output is unchanged, and the prefetch window grows with the latency of the storage. Latency is induced by delaying
+# pread(2), which the prefetcher uses to time the arrival of advised data (htslib reads files with read(2), so only the probes are delayed)
+source "$(dirname "$0")/common.sh"
+
+cat > "$TMP_DIR/delay.c" <<'EOF'
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+ssize_t pread(int fd, void *buffer, size_t size, off_t offset) {
+    static ssize_t (*real_pread)(int, void*, size_t, off_t) = NULL;
+    if (real_pread == NULL) real_pread = (ssize_t (*)(int, void*, size_t, off_t))dlsym(RTLD_NEXT, "pread");
+    struct timespec delay = {0, atol(getenv("PREAD_DELAY_MS")) * 1000000L};
+    nanosleep(&delay, NULL);
+    return real_pread(fd, buffer, size, offset);
+}
+
+ssize_t pread64(int fd, void *buffer, size_t size, off_t offset) {
+    return pread(fd, buffer, size, offset);
+}
+EOF
+if ! ${CC:-cc} -shared -fPIC -O2 -o "$TMP_DIR/delay.so" "$TMP_DIR/delay.c" -ldl; then
+    echo "Error compiling the pread delay library"
+    exit 1
+fi
+
+
+# Run with readahead and a pread delay of <delay> ms, writing the output to <output>, and print the largest prefetch window in MB
+run_delayed() {
+    local output=$1 delay=$2
+    PREAD_DELAY_MS=$delay LD_PRELOAD="$TMP_DIR/delay.so" run "$output" -A -c 2000
+    sed -n 's/^Prefetch: .*window up to \([0-9]*\) MB$/\1/p' "$TMP_DIR/log.txt"
+}
+
+
+run "$TMP_DIR/text.txt" -c 2000
+window_fast=$(run_delayed "$TMP_DIR/fast.txt" 0)
+window_slow=$(run_delayed "$TMP_DIR/slow.txt" 50)
+echo "Prefetch window: ${window_fast} MB without delay, ${window_slow} MB with a 50 ms delay"
+
+check "readahead" "$TMP_DIR/text.txt" "$TMP_DIR/fast.txt"
+check "readahead, slow storage" "$TMP_DIR/text.txt" "$TMP_DIR/slow.txt"
+[ -n "$window_fast" ] && [ -n "$window_slow" ] && [ "$window_slow" -gt "$window_fast" ]
+report "window grows with latency" $?
+
+finish